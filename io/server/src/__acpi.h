@@ -10,6 +10,10 @@
 
 class Pci_survey_config;
 
+namespace Hw {
+  class Device;
+}
+
 class Acpi_config
 {
 public:
@@ -29,9 +33,25 @@ struct acpica_pci_irq
 #ifdef CONFIG_L4IO_ACPI
 int acpica_init();
 void acpi_late_setup();
+
+/**
+ * Probe ACPI devices without a specific driver only on first use.
+ *
+ * Must be called before acpica_init().
+ */
+void acpi_set_lazy(bool lazy);
+
+/// Run the deferred ACPI probe of `dev` (_STA, _CRS), if any.
+void acpi_complete_probe(Hw::Device *dev);
+
+/// Whether the ACPI probe of `dev` was deferred, even if completed since.
+bool acpi_probe_deferred(Hw::Device const *dev);
 #else
 static inline int acpica_init() { return 0; }
 static inline void acpi_late_setup() {}
+static inline void acpi_set_lazy(bool) {}
+static inline void acpi_complete_probe(Hw::Device *) {}
+static inline bool acpi_probe_deferred(Hw::Device const *) { return false; }
 #endif
 
 #if defined(CONFIG_L4IO_ACPI) && (defined(ARCH_x86) || defined(ARCH_amd64))
@@ -74,6 +74,14 @@ unsigned acpi_get_debug_level()
   return _acpi_debug_level;
 }
 
+// Probe devices without a specific driver on first use, see --acpi-lazy.
+static bool _acpi_lazy;
+
+void acpi_set_lazy(bool lazy)
+{
+  _acpi_lazy = lazy;
+}
+
 namespace {
 
 struct Acpi_default_driver : Hw::Acpi_device_driver {};
@@ -86,6 +94,28 @@ static Hw::Acpi_device_driver *acpi_default_driver()
   return &d;
 }
 
+/// Devices with a deferred probe, the handle is reset once probed.
+typedef std::map<Hw::Device const *, ACPI_HANDLE> Deferred_probes;
+
+static Deferred_probes &deferred_probes()
+{
+  static Deferred_probes p;
+  return p;
+}
+
+/**
+ * \brief Check whether an ACPI device has an IRQ routing table.
+ *
+ * The routing table must be known before the devices below are initialized,
+ * so such devices are never probed lazily. This only looks up the name, it
+ * does not evaluate _PRT.
+ */
+static bool acpi_has_prt(ACPI_HANDLE obj)
+{
+  ACPI_HANDLE prt;
+  return ACPI_SUCCESS(AcpiGetHandle(obj, ACPI_STRING("_PRT"), &prt));
+}
+
 enum Acpi_irq_model_id {
 	ACPI_IRQ_MODEL_PIC = 0,
 	ACPI_IRQ_MODEL_IOAPIC,
@@ -324,7 +354,7 @@ discover_pre_cb(ACPI_HANDLE obj, UINT32 nl, void *ctxt, void **)
     {
       adr = info->Address;
       nd = c->current_bus->get_child_dev_adr(adr, true);
-      if (nd->find_feature<Hw::Acpi_dev>())
+      if (nd->find_feature<Hw::Acpi_dev>() || deferred_probes().count(nd))
         nd = 0;
     }
 
@@ -365,8 +395,16 @@ discover_pre_cb(ACPI_HANDLE obj, UINT32 nl, void *ctxt, void **)
     drv =  Hw::Acpi_device_driver::find(info->Type);
 
   if (!drv)
-    drv = acpi_default_driver();
+    {
+      drv = acpi_default_driver();
 
+      // evaluate _STA and _CRS only when a virtual bus uses the device
+      if (_acpi_lazy && !acpi_has_prt(obj))
+        {
+          deferred_probes()[nd] = obj;
+          return AE_OK;
+        }
+    }
 
   drv->probe(nd, obj, info.get());
 
@@ -827,6 +865,9 @@ int acpica_init()
       exit(status);
 
   d_printf(DBG_INFO, "ACPI subsystem initialized\n");
+  if (_acpi_lazy)
+    d_printf(DBG_INFO, "ACPI: deferred the probe of %zu devices\n",
+             deferred_probes().size());
 
     {
       Acpi_auto_buffer ret_buffer;
@@ -887,6 +928,29 @@ void acpi_late_setup()
 #endif
 }
 
+void acpi_complete_probe(Hw::Device *dev)
+{
+  auto i = deferred_probes().find(dev);
+  if (i == deferred_probes().end() || !i->second)
+    return;
+
+  ACPI_HANDLE obj = i->second;
+  i->second = 0;
+
+  if (dlevel(DBG_DEBUG))
+    d_printf(DBG_DEBUG, "ACPI: %s: probing on first use\n",
+             dev->get_full_path().c_str());
+  acpi_default_driver()->probe(dev, obj, 0);
+
+  // the device is initialized already, so allocate the _CRS resources here
+  dev->allocate_pending_resources();
+}
+
+bool acpi_probe_deferred(Hw::Device const *dev)
+{
+  return deferred_probes().count(dev);
+}
+
 
 
 namespace Hw {
@@ -14,9 +14,19 @@ namespace Hw {
 class Io_config
 {
 public:
+  /// Allocation mode for PCI BARs and bridge windows.
+  enum Pci_alloc
+  {
+    Pci_alloc_firmware, ///< Keep the firmware assignments if they fit.
+    Pci_alloc_global,   ///< Size and place all windows anew.
+    Pci_alloc_dry_run,  ///< Keep the firmware, report the global layout.
+  };
+
   virtual bool transparent_msi(Hw::Device *) const = 0;
   virtual bool legacy_ide_resources(Hw::Device *) const = 0;
   virtual bool expansion_rom(Hw::Device *) const = 0;
+  virtual bool sriov_lazy_vfs(Hw::Device *) const = 0;
+  virtual Pci_alloc pci_alloc() const = 0;
   virtual int verbose() const = 0;
   virtual ~Io_config() = 0;
 
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include "cid_matcher.h"
+
+#include <l4/vbus/vbus_types.h>
+
+#include <algorithm>
+#include <map>
+
+#include "debug.h"
+#include "hw_device.h"
+
+namespace Hw {
+
+namespace {
+
+typedef std::vector<unsigned> Pos_list;
+
+/**
+ * Index of a whole device tree.
+ *
+ * Devices are numbered in tree order, so the subtree of a device is a
+ * contiguous range of numbers and all lists below are sorted.
+ */
+struct Index
+{
+  Device *root = nullptr;
+  unsigned long generation = 0;
+
+  std::vector<Device *> devs;
+  Pos_list subtree_end;              ///< number after the last descendant
+  std::map<Device const *, unsigned> pos;
+
+  /// Devices with a HID or a compatible ID that looks like a PCI ID.
+  Pos_list pci_named;
+
+#ifdef CONFIG_L4IO_PCI
+  Pos_list pci;
+  std::map<l4_uint32_t, Pos_list> by_vendor_device;
+  std::map<l4_uint32_t, Pos_list> by_vendor;
+  std::map<l4_uint32_t, Pos_list> by_class;      ///< base and sub class
+  std::map<l4_uint32_t, Pos_list> by_base_class;
+
+  Pos_list const *candidates(Pci::Cid const &c) const;
+#endif
+
+  void build(Device *root);
+};
+
+Index _index;
+
+#ifdef CONFIG_L4IO_PCI
+Pci::Dev *
+pci_dev(Device *d)
+{ return d->find_feature<Pci::Dev>(); }
+
+Pos_list const *
+find_list(std::map<l4_uint32_t, Pos_list> const &m, l4_uint32_t key)
+{
+  static Pos_list const empty;
+  auto i = m.find(key);
+  return i == m.end() ? &empty : &i->second;
+}
+
+/// The smallest list of PCI functions that may match `c`.
+Pos_list const *
+Index::candidates(Pci::Cid const &c) const
+{
+  if (c.vd_mask == ~0U)
+    return find_list(by_vendor_device, c.vd_val);
+  if ((c.vd_mask & 0xffff) == 0xffff)
+    return find_list(by_vendor, c.vd_val & 0xffff);
+  if ((c.cc_mask & 0xffff0000) == 0xffff0000)
+    return find_list(by_class, c.cc_val >> 16);
+  if ((c.cc_mask & 0xff000000) == 0xff000000)
+    return find_list(by_base_class, c.cc_val >> 24);
+  return &pci;
+}
+#endif
+
+void
+Index::build(Device *r)
+{
+  *this = Index();
+  root = r;
+
+  // complete pending initializations before the iteration descends into a
+  // device, they discover its children
+  for (auto i = Device::iterator(0, r, L4VBUS_MAX_DEPTH); i != r->end(); ++i)
+    {
+      Device *d = *i;
+      Async_init::complete(d);
+      unsigned n = devs.size();
+      devs.push_back(d);
+      pos[d] = n;
+
+      if (d->has_cid_prefix("PCI/"))
+        pci_named.push_back(n);
+
+#ifdef CONFIG_L4IO_PCI
+      if (Pci::Dev *p = pci_dev(d))
+        {
+          l4_uint32_t vd = p->cfg.vendor_device;
+          l4_uint32_t cc = p->cfg.cls_rev;
+          pci.push_back(n);
+          by_vendor_device[vd].push_back(n);
+          by_vendor[vd & 0xffff].push_back(n);
+          by_class[cc >> 16].push_back(n);
+          by_base_class[cc >> 24].push_back(n);
+        }
+#endif
+    }
+
+  // a subtree ends at the next device that is not deeper than its root
+  subtree_end.resize(devs.size());
+  Pos_list open;
+  for (unsigned n = 0; n < devs.size(); ++n)
+    {
+      while (!open.empty() && devs[open.back()]->depth() >= devs[n]->depth())
+        {
+          subtree_end[open.back()] = n;
+          open.pop_back();
+        }
+      open.push_back(n);
+    }
+  for (unsigned n: open)
+    subtree_end[n] = devs.size();
+
+  generation = Device::generation();
+
+  d_printf(DBG_DEBUG, "CID index of %s: %zu devices\n", r->name(),
+           devs.size());
+}
+
+/// The index of the device tree containing `d`.
+Index *
+index_for(Device *d)
+{
+  while (d->parent())
+    d = d->parent();
+
+  if (_index.root != d || _index.generation != Device::generation())
+    _index.build(d);
+
+  return &_index;
+}
+
+/// Append the entries of `l` within `[first, last)` to `out`.
+void
+append_range(Pos_list *out, Pos_list const &l, unsigned first, unsigned last)
+{
+  auto b = std::lower_bound(l.begin(), l.end(), first);
+  auto e = std::lower_bound(b, l.end(), last);
+  out->insert(out->end(), b, e);
+}
+
+}
+
+void
+Cid_matcher::add(std::string const &cid)
+{
+#ifdef CONFIG_L4IO_PCI
+  Pci::Cid c;
+  if (c.parse(cxx::String(cid.c_str(), cid.size())))
+    {
+      _pci.push_back(c);
+      _pci_str.push_back(cid);
+      return;
+    }
+#endif
+
+  _other.push_back(cid);
+}
+
+bool
+Cid_matcher::match(Device *d) const
+{
+  for (auto const &c: _other)
+    if (d->match_cid(cxx::String(c.c_str(), c.size())))
+      return true;
+
+#ifdef CONFIG_L4IO_PCI
+  if (_pci.empty())
+    return false;
+
+  if (Pci::Dev *p = pci_dev(d))
+    for (auto const &c: _pci)
+      if (c.match(p))
+        return true;
+
+  // a HID or compatible ID may be given as PCI ID as well
+  if (d->has_cid_prefix("PCI/"))
+    for (auto const &c: _pci_str)
+      if (d->match_cid(cxx::String(c.c_str(), c.size())))
+        return true;
+#endif
+
+  return false;
+}
+
+void
+Cid_matcher::find(Device *root, std::vector<Device *> *devs) const
+{
+  Index const *ix = index_for(root);
+  unsigned first = ix->pos.at(root);
+  unsigned last = ix->subtree_end[first];
+
+  if (!_other.empty())
+    {
+      for (unsigned n = first; n < last; ++n)
+        if (match(ix->devs[n]))
+          devs->push_back(ix->devs[n]);
+      return;
+    }
+
+#ifdef CONFIG_L4IO_PCI
+  Pos_list cand;
+  for (auto const &c: _pci)
+    append_range(&cand, *ix->candidates(c), first, last);
+  append_range(&cand, ix->pci_named, first, last);
+
+  std::sort(cand.begin(), cand.end());
+  cand.erase(std::unique(cand.begin(), cand.end()), cand.end());
+
+  for (unsigned n: cand)
+    if (match(ix->devs[n]))
+      devs->push_back(ix->devs[n]);
+#endif
+}
+
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#ifdef CONFIG_L4IO_PCI
+#include "pci-dev.h"
+#endif
+
+namespace Hw {
+
+class Device;
+
+/**
+ * A list of compatible IDs compiled for matching whole device trees.
+ *
+ * PCI IDs are parsed once into mask/value form and looked up in an index of
+ * the PCI functions of the device tree, keyed by vendor/device ID and class
+ * code, so only candidate devices are visited. Other IDs are matched with
+ * Device::match_cid() against each device of the subtree.
+ *
+ * A device matches if it matches any of the IDs, exactly like with
+ * Device::match_cid().
+ */
+class Cid_matcher
+{
+public:
+  void add(std::string const &cid);
+
+  bool match(Device *d) const;
+
+  /**
+   * Find the matching devices of a subtree.
+   *
+   * \param root  Root of the subtree, matched itself as well.
+   * \param devs  The matching devices are appended in tree order.
+   */
+  void find(Device *root, std::vector<Device *> *devs) const;
+
+private:
+  std::vector<std::string> _other; ///< IDs matched with Device::match_cid()
+
+#ifdef CONFIG_L4IO_PCI
+  std::vector<Pci::Cid> _pci;
+  std::vector<std::string> _pci_str; ///< `_pci` as given, for HIDs and CIDs
+#endif
+};
+
+}
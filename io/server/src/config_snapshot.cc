@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include "config_snapshot.h"
+
+#include <l4/re/env>
+#include <l4/re/dataspace>
+#include <l4/re/rm>
+#include <l4/vbus/vbus_types.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "__acpi.h"
+#include "debug.h"
+#include "hw_async_init.h"
+#include "hw_device.h"
+#include "main.h"
+#include "virt/vbus_factory.h"
+#include "virt/vdevice.h"
+
+int add_vbus(Vi::Device *dev);
+
+namespace {
+
+/// 64-bit FNV-1a hash.
+struct Fnv
+{
+  l4_uint64_t h = 0xcbf29ce484222325ULL;
+
+  void add(void const *data, l4_size_t len)
+  {
+    auto const *p = static_cast<unsigned char const *>(data);
+    for (l4_size_t i = 0; i < len; ++i)
+      {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+      }
+  }
+
+  void add(char const *s)
+  {
+    if (s)
+      add(s, strlen(s) + 1);
+    else
+      add_val<l4_uint8_t>(0xff);
+  }
+
+  template<typename T>
+  void add_val(T v)
+  { add(&v, sizeof(v)); }
+};
+
+}
+
+Config_snapshot *
+Config_snapshot::get()
+{
+  static Config_snapshot s;
+  return &s;
+}
+
+/**
+ * Fingerprint of the hardware description.
+ *
+ * Resource addresses are left out, they may change with the allocation. So
+ * are the resources of lazily probed ACPI devices, they only appear once a
+ * virtual bus uses the device.
+ */
+l4_uint64_t
+Config_snapshot::hw_fingerprint()
+{
+  Fnv f;
+  for (auto i = Hw::Device::iterator(0, system_bus(), L4VBUS_MAX_DEPTH);
+       i != system_bus()->end(); ++i)
+    {
+      Hw::Device *d = *i;
+      f.add_val<l4_int32_t>(d->depth());
+      f.add(d->name());
+      f.add(d->hid());
+
+      if (!acpi_probe_deferred(d))
+        for (Resource const *r: *d->resources())
+          if (r)
+            {
+              f.add_val<l4_uint32_t>(r->type());
+              f.add_val<l4_uint64_t>(r->size());
+            }
+
+      d->for_each_property([&f](std::string const &name, Property *p)
+        {
+          f.add(name.c_str());
+          if (auto const *s = dynamic_cast<String_property const *>(p))
+            f.add(s->val().c_str());
+          else if (auto const *v = dynamic_cast<Int_property const *>(p))
+            f.add_val<l4_int64_t>(v->val());
+        });
+    }
+
+  return f.h;
+}
+
+/// Position of a hardware device in the tree, as child indices.
+std::string
+Config_snapshot::hw_path(Hw::Device *hw)
+{
+  std::string path;
+  for (; hw->parent(); hw = hw->parent())
+    {
+      unsigned idx = 0;
+      for (Hw::Device *c = hw->parent()->children(); c != hw; c = c->next())
+        ++idx;
+
+      char buf[16];
+      snprintf(buf, sizeof(buf), "/%u", idx);
+      path.insert(0, buf);
+    }
+  return path;
+}
+
+Hw::Device *
+Config_snapshot::find_hw(std::string const &path)
+{
+  Hw::Device *d = system_bus();
+  char const *p = path.c_str();
+  while (*p == '/')
+    {
+      char *end;
+      unsigned long idx = strtoul(p + 1, &end, 10);
+      if (end == p + 1)
+        return nullptr;
+
+      Hw::Device *c = d->children();
+      for (; c && idx; --idx)
+        c = c->next();
+
+      if (!c)
+        return nullptr;
+
+      d = c;
+      p = end;
+    }
+
+  return *p ? nullptr : d;
+}
+
+int
+Config_snapshot::init(char const *cap_name, char const *const *files,
+                      unsigned num_files)
+{
+  // devices with a pending initialization may still add children
+  Hw::Async_init::complete_all();
+
+  _recording = true;
+  _hw_fp = hw_fingerprint();
+
+  extern char const _binary_io_lua_start[];
+  extern char const _binary_io_lua_end[];
+
+  Fnv f;
+  f.add(_binary_io_lua_start, _binary_io_lua_end - _binary_io_lua_start);
+  for (unsigned i = 0; i < num_files; ++i)
+    {
+      f.add(files[i]);
+      FILE *fp = fopen(files[i], "r");
+      if (!fp)
+        {
+          // let the configuration report the error
+          _recording = false;
+          return -L4_ENOENT;
+        }
+
+      char buf[512];
+      l4_size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        f.add(buf, n);
+      fclose(fp);
+    }
+  _cfg_fp = f.h;
+
+  auto ds = L4Re::Env::env()->get_cap<L4Re::Dataspace>(cap_name);
+  if (!ds.is_valid())
+    {
+      d_printf(DBG_WARN, "warning: config snapshot: no capability '%s'\n",
+               cap_name);
+      _recording = false;
+      return -L4_ENOENT;
+    }
+
+  _size = ds->size();
+  if (_size < sizeof(Header))
+    {
+      d_printf(DBG_WARN, "warning: config snapshot: dataspace too small\n");
+      _recording = false;
+      return -L4_EINVAL;
+    }
+
+  _writable = ds->flags().w();
+
+  auto rm_flags = L4Re::Rm::F::Search_addr | L4Re::Rm::F::Eager_map
+                  | (_writable ? L4Re::Rm::F::RW : L4Re::Rm::F::R);
+  l4_addr_t addr = 0;
+  int r = L4Re::Env::env()->rm()->attach(&addr, _size, rm_flags,
+                                         L4::Ipc::make_cap(ds, _writable
+                                                               ? L4_CAP_FPAGE_RW
+                                                               : L4_CAP_FPAGE_RO));
+  if (r < 0)
+    {
+      d_printf(DBG_ERR, "error: config snapshot: cannot attach dataspace: %d\n",
+               r);
+      _recording = false;
+      return r;
+    }
+
+  _buf = reinterpret_cast<char *>(addr);
+
+  auto const *h = reinterpret_cast<Header const *>(_buf);
+  l4_size_t avail = _size - sizeof(Header);
+
+  if (h->magic != Magic || h->version != Version
+      || h->num_nodes > avail / sizeof(Node)
+      || h->strings_size > avail - h->num_nodes * sizeof(Node))
+    {
+      d_printf(DBG_INFO, "config snapshot: empty or invalid\n");
+      return -L4_EINVAL;
+    }
+
+  Fnv c;
+  c.add(h + 1, h->num_nodes * sizeof(Node) + h->strings_size);
+  if (c.h != h->checksum)
+    {
+      d_printf(DBG_INFO, "config snapshot: checksum mismatch\n");
+      return -L4_EINVAL;
+    }
+
+  if (h->cfg_fingerprint != _cfg_fp)
+    {
+      d_printf(DBG_INFO, "config snapshot: configuration changed\n");
+      return -L4_EINVAL;
+    }
+
+  if (h->hw_fingerprint != _hw_fp)
+    {
+      d_printf(DBG_INFO, "config snapshot: hardware changed\n");
+      return -L4_EINVAL;
+    }
+
+  return 0;
+}
+
+int
+Config_snapshot::load()
+{
+  if (!_buf)
+    return -L4_EINVAL;
+
+  auto const *h = reinterpret_cast<Header const *>(_buf);
+  auto const *nodes = reinterpret_cast<Node const *>(h + 1);
+  char const *strings = reinterpret_cast<char const *>(nodes + h->num_nodes);
+  unsigned num = h->num_nodes;
+
+  auto str = [&](l4_uint32_t off) -> char const *
+    {
+      if (off >= h->strings_size
+          || !memchr(strings + off, 0, h->strings_size - off))
+        return nullptr;
+      return strings + off;
+    };
+
+  // resolve everything first, so that nothing is created on a mismatch
+  std::vector<Hw::Device *> hw(num, nullptr);
+  for (unsigned i = 0; i < num; ++i)
+    {
+      Node const &n = nodes[i];
+      char const *arg = str(n.arg);
+      bool ok = arg
+                && (i ? n.depth <= nodes[i - 1].depth + 1 : n.depth == 0)
+                && (n.name == ~0U || str(n.name));
+
+      if (ok && n.kind == K_proxy)
+        ok = n.depth && (hw[i] = find_hw(arg));
+      else if (ok)
+        ok = n.kind == K_class && Vi::Dev_factory::has_class(arg);
+
+      if (!ok)
+        {
+          d_printf(DBG_WARN, "warning: config snapshot: entry %u unusable\n",
+                   i);
+          return -L4_EINVAL;
+        }
+    }
+
+  _recording = false;
+
+  std::vector<Vi::Device *> stack;
+  std::vector<Vi::Device *> buses;
+  for (unsigned i = 0; i < num; ++i)
+    {
+      Node const &n = nodes[i];
+      stack.resize(n.depth);
+      Vi::Device *parent = n.depth ? stack.back() : nullptr;
+      Vi::Device *vd = nullptr;
+      if (!n.depth || parent)
+        vd = n.kind == K_proxy
+             ? Vi::Dev_factory::create(hw[i])
+             : Vi::Dev_factory::create(std::string(str(n.arg)));
+
+      if (!vd)
+        {
+          d_printf(DBG_ERR, "error: config snapshot: cannot create '%s'\n",
+                   str(n.arg));
+          stack.push_back(nullptr);
+          continue;
+        }
+
+      if (n.name != ~0U)
+        vd->name(cxx::String(str(n.name), strlen(str(n.name))));
+
+      if (auto *p = dynamic_cast<Int_property *>(vd->property("num_msis")))
+        p->set(-1, l4_int64_t(n.num_msis));
+
+      if (parent)
+        parent->add_child(vd);
+      else
+        buses.push_back(vd);
+      stack.push_back(vd);
+    }
+
+  for (Vi::Device *b: buses)
+    ::add_vbus(b);
+
+  d_printf(DBG_INFO, "config snapshot: created %zu virtual buses\n",
+           buses.size());
+  return 0;
+}
+
+void
+Config_snapshot::created(Vi::Device *vd, Hw::Device *hw)
+{
+  if (!_recording || !vd)
+    return;
+
+  _origins[vd] = Origin{hw, std::string(), vd->name(),
+                        unsigned(vd->resources()->size())};
+}
+
+void
+Config_snapshot::created(Vi::Device *vd, char const *cls)
+{
+  if (!_recording || !vd)
+    return;
+
+  _origins[vd] = Origin{nullptr, cls, vd->name(),
+                        unsigned(vd->resources()->size())};
+}
+
+void
+Config_snapshot::unsupported(char const *what)
+{
+  if (_recording && !_unsupported)
+    _unsupported = what;
+}
+
+l4_uint32_t
+Config_snapshot::add_string(std::string const &s)
+{
+  l4_uint32_t off = _strings.size();
+  _strings.append(s.c_str(), s.size() + 1);
+  return off;
+}
+
+void
+Config_snapshot::add_vbus(Vi::Device *bus)
+{
+  if (!_recording || _unsupported)
+    return;
+
+  std::vector<Vi::Device *> devs;
+  devs.push_back(bus);
+  for (auto i = bus->begin(L4VBUS_MAX_DEPTH); i != bus->end(); ++i)
+    devs.push_back(*i);
+
+  for (Vi::Device *d: devs)
+    {
+      auto o = _origins.find(d);
+      if (o == _origins.end())
+        {
+          unsupported("uses an unknown virtual device");
+          return;
+        }
+
+      if (d->resources()->size() != o->second.num_resources)
+        {
+          unsupported("adds resources to virtual devices");
+          return;
+        }
+
+      Node n;
+      n.kind = o->second.hw ? K_proxy : K_class;
+      n.depth = d->depth() - bus->depth();
+      n.name = o->second.name == d->name() ? ~0U : add_string(d->name());
+      n.arg = add_string(o->second.hw ? hw_path(o->second.hw)
+                                      : o->second.cls);
+      n.num_msis = 0;
+      if (auto *p = dynamic_cast<Int_property *>(d->property("num_msis")))
+        n.num_msis = p->val();
+
+      _nodes.push_back(n);
+    }
+}
+
+void
+Config_snapshot::store()
+{
+  if (!_buf || !_recording)
+    return;
+
+  _recording = false;
+
+  if (!_unsupported && hw_fingerprint() != _hw_fp)
+    _unsupported = "modifies the hardware description";
+
+  if (_unsupported)
+    {
+      d_printf(DBG_INFO, "config snapshot: not stored, configuration %s\n",
+               _unsupported);
+      return;
+    }
+
+  if (!_writable)
+    {
+      d_printf(DBG_WARN, "warning: config snapshot: stale but read-only\n");
+      return;
+    }
+
+  l4_size_t nodes_size = _nodes.size() * sizeof(Node);
+  if (sizeof(Header) + nodes_size + _strings.size() > _size)
+    {
+      d_printf(DBG_WARN, "warning: config snapshot: dataspace too small\n");
+      return;
+    }
+
+  auto *h = reinterpret_cast<Header *>(_buf);
+
+  // invalidate first, so that an interrupted update is never taken as valid
+  h->magic = 0;
+
+  char *p = reinterpret_cast<char *>(h + 1);
+  if (nodes_size)
+    memcpy(p, _nodes.data(), nodes_size);
+  memcpy(p + nodes_size, _strings.data(), _strings.size());
+
+  Fnv c;
+  c.add(p, nodes_size + _strings.size());
+
+  h->hw_fingerprint = _hw_fp;
+  h->cfg_fingerprint = _cfg_fp;
+  h->num_nodes = _nodes.size();
+  h->strings_size = _strings.size();
+  h->checksum = c.h;
+  h->version = Version;
+  h->magic = Magic;
+
+  d_printf(DBG_INFO, "config snapshot: stored %zu virtual devices\n",
+           _nodes.size());
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <l4/sys/l4int.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Hw {
+class Device;
+}
+
+namespace Vi {
+class Device;
+}
+
+/**
+ * Precompiled snapshot of the virtual bus configuration.
+ *
+ * The snapshot stores the virtual buses built by the Lua configuration: for
+ * each bus its name and `num_msis` property, and the tree of virtual devices
+ * with their names and either the factory class they were created from or the
+ * hardware device they wrap. The snapshot is kept in a dataspace passed to io
+ * (`--config-snapshot=<cap>`).
+ *
+ * It is only used if fingerprints of the configuration files and of the
+ * discovered hardware (device tree, IDs, resource sizes and property values)
+ * match the ones recorded with it. Then the virtual buses are created directly
+ * and Lua is not started at all. Otherwise the configuration is run and the
+ * snapshot is rewritten, unless the configuration did something the snapshot
+ * cannot reproduce, e.g. added hardware devices or set GPIO pin filters.
+ */
+class Config_snapshot
+{
+public:
+  enum
+  {
+    Magic   = 0x53436f69, // 'ioCS'
+    Version = 1,
+  };
+
+  enum Kind : l4_uint16_t
+  {
+    K_class = 1, ///< created by name, e.g. "System_bus"
+    K_proxy = 2, ///< created for a hardware device
+  };
+
+  struct Node
+  {
+    l4_uint16_t kind;
+    l4_uint16_t depth;    ///< depth below the virtual bus, 0 for the bus
+    l4_uint32_t name;     ///< string offset, ~0U to keep the default name
+    l4_uint32_t arg;      ///< string offset of the class or hardware path
+    l4_int32_t  num_msis; ///< for virtual buses
+  };
+
+  struct Header
+  {
+    l4_uint32_t magic;
+    l4_uint32_t version;
+    l4_uint64_t hw_fingerprint;
+    l4_uint64_t cfg_fingerprint;
+    l4_uint32_t num_nodes;
+    l4_uint32_t strings_size;
+    l4_uint64_t checksum;
+  };
+
+  static Config_snapshot *get();
+
+  /**
+   * Attach the snapshot dataspace and compute the fingerprints of the
+   * hardware discovered so far and of the configuration files.
+   *
+   * \retval 0   The snapshot matches and can be loaded.
+   * \retval <0  No usable snapshot, the configuration has to be run.
+   */
+  int init(char const *cap_name, char const *const *files, unsigned num_files);
+
+  /**
+   * Create and register the virtual buses stored in the snapshot.
+   *
+   * Nothing is created if any referenced device does not exist.
+   *
+   * \retval 0   All virtual buses were created.
+   * \retval <0  The snapshot is unusable, the configuration has to be run.
+   */
+  int load();
+
+  /// Note the creation of a virtual device for a hardware device.
+  void created(Vi::Device *vd, Hw::Device *hw);
+  /// Note the creation of a virtual device by its class name.
+  void created(Vi::Device *vd, char const *cls);
+  /// Note a configuration step the snapshot cannot reproduce.
+  void unsupported(char const *what);
+  /// Record a virtual bus when it is registered.
+  void add_vbus(Vi::Device *bus);
+
+  /// Write the recorded configuration to the snapshot dataspace.
+  void store();
+
+  bool recording() const { return _recording; }
+
+private:
+  struct Origin
+  {
+    Hw::Device *hw;
+    std::string cls;
+    std::string name;
+    unsigned num_resources;
+  };
+
+  l4_uint32_t add_string(std::string const &s);
+  static l4_uint64_t hw_fingerprint();
+  static std::string hw_path(Hw::Device *hw);
+  static Hw::Device *find_hw(std::string const &path);
+
+  char *_buf = nullptr;
+  l4_size_t _size = 0;
+  bool _writable = false;
+  bool _recording = false;
+  char const *_unsupported = nullptr;
+
+  l4_uint64_t _hw_fp = 0;
+  l4_uint64_t _cfg_fp = 0;
+
+  std::map<Vi::Device const *, Origin> _origins;
+  std::vector<Node> _nodes;
+  std::string _strings;
+};
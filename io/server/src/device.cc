@@ -9,15 +9,32 @@
 
 #include <typeinfo>
 #include <cassert>
+#include <cstring>
 #include <set>
+#include <vector>
 
 std::string
 Generic_device::get_full_path() const
 {
-  if (!parent())
-    return std::string("/") + name();
+  // build the path in one go, deep trees would otherwise copy the path of
+  // each parent again
+  std::vector<char const *> names;
+  std::size_t len = 0;
+  for (Device const *d = this; d; d = d->parent())
+    {
+      names.push_back(d->name());
+      len += strlen(names.back()) + 1;
+    }
 
-  return parent()->get_full_path() + "/" + name();
+  std::string path;
+  path.reserve(len);
+  for (auto n = names.rbegin(); n != names.rend(); ++n)
+    {
+      path += '/';
+      path += *n;
+    }
+
+  return path;
 }
 
 
@@ -35,6 +52,25 @@ Generic_device::get_full_path() const
 
 bool
 Device::alloc_child_resource(Resource *r, Device *cld)
+{
+  // resources with a negotiable size fall back to smaller sizes, e.g. the
+  // power-on size of a resizable BAR, before they are given up
+  r->fit_alloc(this);
+  do
+    if (try_alloc_child_resource(r, cld))
+      return true;
+  while (r->shrink_alloc());
+
+  d_printf(DBG_ERR, "ERROR: could not reserve resource\n");
+  if (dlevel(DBG_ERR))
+    r->dump();
+
+  r->disable();
+  return false;
+}
+
+bool
+Device::try_alloc_child_resource(Resource *r, Device *cld)
 {
   bool found_as = false;
   // The first run requires exact match between client and parent resource.
@@ -42,6 +78,7 @@ Device::alloc_child_resource(Resource *r, Device *cld)
   // non-prefetchable MMIO parent resource.
   bool exact = true;
   auto const *rl = resources();
+
   while (true)
     {
       for (auto *br: *rl)
@@ -88,13 +125,8 @@ Device::alloc_child_resource(Resource *r, Device *cld)
       else
         {
           if (!found_as && parent())
-            return parent()->alloc_child_resource(r, cld);
+            return parent()->try_alloc_child_resource(r, cld);
 
-          d_printf(DBG_ERR, "ERROR: could not reserve resource\n");
-          if (dlevel(DBG_ERR))
-            r->dump();
-
-          r->disable();
           return false;
         }
     }
@@ -174,8 +206,13 @@ struct Res_dev
   Res_dev(Resource *r, Device *d) : r(r), d(d) {}
 };
 
+// larger alignments first, larger sizes first within the same alignment
 static bool res_cmp(Res_dev const &l, Res_dev const &r)
-{ return l.r->alignment() > r.r->alignment(); }
+{
+  if (l.r->alignment() != r.r->alignment())
+    return l.r->alignment() > r.r->alignment();
+  return l.r->size() > r.r->size();
+}
 
 typedef std::multiset<Res_dev, bool (*)(Res_dev const &l, Res_dev const &r)> UAD;
 
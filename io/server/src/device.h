@@ -15,6 +15,7 @@
 #include <l4/cxx/bitfield>
 #include <l4/cxx/unique_ptr>
 
+#include "pool_alloc.h"
 #include "resource.h"
 #include "debug.h"
 
@@ -34,7 +35,8 @@ template<typename D> class Device_tree_mixin;
  * The parent has only one pointer to a child node.
  * Sibling nodes have the same parent node and the same depth in the tree.
  * The siblings form a single-linked list via their next pointer.
- * The head of this single-linked list is the child pointer in the parent node.
+ * The head of this single-linked list is the child pointer in the parent node,
+ * the parent also keeps a pointer to the tail to append new children.
  *
  * The depth describes the number of parent nodes until the root node is
  * reached.
@@ -49,10 +51,11 @@ private:
   D *_n;        ///< next sibling node
   D *_p;        ///< parent node
   D *_c;        ///< child node
+  D *_last;     ///< last child node
   int _depth;   ///< depth of this node
 
 public:
-  Device_tree() : _n(0), _p(0), _c(0), _depth(0) {}
+  Device_tree() : _n(0), _p(0), _c(0), _last(0), _depth(0) {}
 
   D *parent() const { return _p; }
   D *children() const { return _c; }
@@ -93,12 +96,9 @@ private:
     if (!_c)
       _c = d;
     else
-      {
-        D *p;
-        for (p = _c; p->next(); p = p->next())
-          ;
-        p->add_sibling(d);
-      }
+      _last->add_sibling(d);
+
+    _last = d;
   }
 
   void set_depth(int d) { _depth = d; }
@@ -237,7 +237,7 @@ public:
 };
 
 
-class Device : public Resource_container
+class Device : public Resource_container, public Pool_object
 {
 public:
   /**
@@ -304,6 +304,9 @@ public:
   virtual int pm_resume() = 0;
 
   virtual std::string get_full_path() const = 0;
+
+private:
+  bool try_alloc_child_resource(Resource *, Device *);
 };
 
 class Property;
@@ -375,6 +378,14 @@ public:
    */
   Property *property(std::string const &name);
 
+  /// Call `fn(name, property)` for each registered property.
+  template<typename FN>
+  void for_each_property(FN &&fn) const
+  {
+    for (auto const &p: _properties)
+      fn(p.first, p.second);
+  }
+
   /**
    * Verify that the property was set and return an error otherwise.
    *
@@ -430,7 +441,7 @@ public:
  * This class is not intended to be used directly. Instead you should inherit
  * from this class to define your own property type if necessary.
  */
-class Property
+class Property : public Pool_object
 {
 public:
   Property() = default;
@@ -12,6 +12,7 @@
 #include "utils.h"
 #include "resource_provider.h"
 
+#include <cstdio>
 #include <errno.h>
 #include <inttypes.h>
 
@@ -40,8 +41,9 @@ Dwc_pcie::host_init()
       return false;
     }
 
-  if (l4_addr_t va = res_map_iomem(_cfg_base, _cfg_size))
-    _cfg = new L4drivers::Mmio_register_block<32>(va);
+  l4_addr_t cfg_va = res_map_iomem(_cfg_base, _cfg_size);
+  if (cfg_va)
+    _cfg = new L4drivers::Mmio_register_block<32>(cfg_va);
   else
     {
       error("could not map config space memory.");
@@ -111,14 +113,75 @@ Dwc_pcie::host_init()
     }
   _num_ib_windows = i;
 
+  init_cfg_windows(cfg_va);
+
   return true;
 }
 
 void
+Dwc_pcie::init_cfg_windows(l4_addr_t cfg_va)
+{
+  // Region Idx0 is used for the memory window, the config windows start at
+  // Idx1. In legacy mode only two viewports are supported.
+  unsigned n = 1;
+  if (_iatu_unroll_enabled && _num_ob_windows > 2)
+    n = cxx::min<unsigned>(_num_ob_windows - 1, Max_cfg_windows);
+
+  // With several windows, each one must be a power of two in size, aligned
+  // to its size and at least the minimum iATU region size, so that its base
+  // and limit can be programmed into the iATU.
+  while (n & (n - 1))
+    --n;
+
+  l4_uint64_t win_size = _cfg_size;
+  for (; n > 1; n /= 2)
+    {
+      if (_cfg_size / n < Cfg_window_min)
+        continue;
+
+      win_size = 1ULL << (63 - __builtin_clzll(_cfg_size / n));
+      if (!(_cfg_base & (win_size - 1)))
+        break;
+    }
+
+  if (n == 1)
+    win_size = _cfg_size;
+
+  _num_cfg_windows = n;
+  _cfg_win_size = win_size;
+  for (unsigned i = 0; i < n; ++i)
+    {
+      _cfg_win[i].target = Cfg_window_none;
+      if (i == 0)
+        _cfg_win[i].regs = _cfg;
+      else
+        _cfg_win[i].regs =
+          new L4drivers::Mmio_register_block<32>(cfg_va + i * _cfg_win_size);
+    }
+
+  d_printf(DBG_DEBUG, "%s: %u config window(s) of %llu KiB\n", name(), n,
+           _cfg_win_size >> 10);
+}
+
+void
+Dwc_pcie::invalidate_cfg_windows()
+{
+  for (unsigned i = 0; i < _num_cfg_windows; ++i)
+    _cfg_win[i].target = Cfg_window_none;
+}
+
+bool
 Dwc_pcie::set_iatu_region(unsigned index, l4_uint64_t base_addr,
                           l4_uint64_t size, l4_uint64_t target_addr,
                           unsigned tlp_type, unsigned dir)
 {
+  bool cfg_window = dir == Outbound && index >= Iatu_vp::Idx1
+                    && index - Iatu_vp::Idx1 < _num_cfg_windows;
+
+  // anyone reprogramming a config window invalidates its cached target
+  if (cfg_window)
+    _cfg_win[index - Iatu_vp::Idx1].target = Cfg_window_none;
+
   if (_cpu_fixup != ~0)
     base_addr += _cpu_fixup - _mem_base;
 
@@ -147,7 +210,7 @@ Dwc_pcie::set_iatu_region(unsigned index, l4_uint64_t base_addr,
       _atu[offs + Atu::Unr_ctrl_1] = ctrl1;
       _atu[offs + Atu::Unr_ctrl_2] = Region_enable;
 
-      if (index != 1) // avoid extensive logging during cfg_reads()
+      if (!cfg_window) // avoid extensive logging during cfg_reads()
         d_printf(DBG_DEBUG,
                  "Dwc_pcie::set_iatu_region: %08llx-%08llx => %08llx-%08llx\n",
                  base_addr, limit_addr, target_addr, target_addr + size - 1);
@@ -155,7 +218,7 @@ Dwc_pcie::set_iatu_region(unsigned index, l4_uint64_t base_addr,
       for (unsigned i = 0; i < 10; ++i)
         {
           if ((_atu[offs + Atu::Unr_ctrl_2] & Region_enable) == Region_enable)
-            return;
+            return true;
 
           l4_usleep(10'000);
         }
@@ -165,7 +228,7 @@ Dwc_pcie::set_iatu_region(unsigned index, l4_uint64_t base_addr,
       // The default configuration of the PCIe core only has two viewports.
       // XXX Tegra234 has 8 outbound regions!
       if (index > 1)
-        return;
+        return false;
 
       _regs[Port_logic::Iatu_viewport] = index | (dir & Dir_mask);
       _regs[Port_logic::Iatu_lower_base] = base_addr & 0xffff'ffff;
@@ -186,7 +249,7 @@ Dwc_pcie::set_iatu_region(unsigned index, l4_uint64_t base_addr,
       for (unsigned i = 0; i < 10; ++i)
         {
           if ((_regs[Port_logic::Iatu_ctrl_2] & Region_enable) == Region_enable)
-            return;
+            return true;
 
           l4_usleep(10'000);
         }
@@ -197,6 +260,8 @@ Dwc_pcie::set_iatu_region(unsigned index, l4_uint64_t base_addr,
 #ifdef ARCH_MIPS
   asm volatile ("sync" : : : "memory");
 #endif
+
+  return false;
 }
 
 bool
@@ -283,6 +348,7 @@ Dwc_pcie::setup_rc()
   _regs[Hw::Pci::Config::Command].modify(0x0000ffff, 0x107);
 
   // Disable all outbound windows.
+  invalidate_cfg_windows();
   for (unsigned i = 0; i < _num_ob_windows; ++i)
     {
       if (_iatu_unroll_enabled)
@@ -338,10 +404,26 @@ Dwc_pcie::cfg_regs(Cfg_addr addr)
 
   uint32_t target = ((addr.bus() << 8) | addr.devfn()) << 16;
 
-  // TODO: add cfg type 1 access
-  set_iatu_region(Iatu_vp::Idx1, _cfg_base, _cfg_size, target, Tlp_type::Cfg0);
+  ++_cfg_accesses;
+  for (unsigned i = 0; i < _num_cfg_windows; ++i)
+    if (_cfg_win[i].target == target)
+      return _cfg_win[i].regs;
+
+  // The link partner of the root port is addressed with type-0 requests,
+  // everything behind it with type-1 requests that are forwarded by the
+  // bridges in between.
+  unsigned type = addr.bus() == secondary + 1 ? Tlp_type::Cfg0
+                                              : Tlp_type::Cfg1;
 
-  return _cfg;
+  unsigned i = _cfg_win_next;
+  _cfg_win_next = (i + 1) % _num_cfg_windows;
+  ++_cfg_win_misses;
+
+  if (set_iatu_region(Iatu_vp::Idx1 + i, _cfg_base + i * _cfg_win_size,
+                      _cfg_win_size, target, type))
+    _cfg_win[i].target = target;
+
+  return _cfg_win[i].regs;
 }
 
 int
@@ -352,7 +434,10 @@ Dwc_pcie::cfg_read(Cfg_addr addr, l4_uint32_t *value, Cfg_width w)
   if (!device_valid(addr))
     v = 0xffffffff;
   else
-    v = cfg_regs(addr)[addr.reg() & ~3];
+    {
+      Pthread_mutex_guard g(&_cfg_lock);
+      v = cfg_regs(addr)[addr.reg() & ~3];
+    }
 
   switch (w)
     {
@@ -384,6 +469,7 @@ Dwc_pcie::cfg_write(Cfg_addr addr, l4_uint32_t value, Cfg_width w)
   if (!device_valid(addr))
     return 0;
 
+  Pthread_mutex_guard g(&_cfg_lock);
   auto r = cfg_regs(addr);
   uint32_t mask, shift;
 
@@ -429,7 +515,9 @@ Dwc_pcie::device_valid(Cfg_addr addr)
   if ((addr.bus() == secondary) && (addr.dev() > 0))
     return false;
 
-  if ((addr.bus() > secondary) && (addr.dev() > 0))
+  // the link partner of the root port is the only device on its bus,
+  // busses behind a switch may have more devices
+  if ((addr.bus() == secondary + 1) && (addr.dev() > 0))
     return false;
 
   return true;
@@ -466,3 +554,22 @@ Dwc_pcie::get_pci_ext_cap_offs(l4_uint8_t cap_id) const
 
   return 0;
 }
+
+int
+Dwc_pcie::pm_resume()
+{
+  // the iATU may have lost its state while suspended
+  {
+    Pthread_mutex_guard g(&_cfg_lock);
+    invalidate_cfg_windows();
+  }
+  return Hw::Device::pm_resume();
+}
+
+void
+Dwc_pcie::dump(int indent) const
+{
+  Hw::Device::dump(indent);
+  printf("%*.s  config windows: %u, accesses: %u, iATU updates: %u\n",
+         indent, " ", _num_cfg_windows, _cfg_accesses, _cfg_win_misses);
+}
@@ -204,11 +204,14 @@ public:
    *                     region. This parameter is optional and defaults to
    *                     #Iatu_vp::Outbound.
    *
+   * \retval true   The region was enabled.
+   * \retval false  The region could not be enabled.
+   *
    * The iATU registers are programmed through an index (viewport) which needs
    * to be written into the Iatu_viewport register before accessing the other
    * iATU registers.
    */
-  void set_iatu_region(unsigned index, l4_uint64_t base_addr, l4_uint64_t size,
+  bool set_iatu_region(unsigned index, l4_uint64_t base_addr, l4_uint64_t size,
                        l4_uint64_t target_addr, unsigned tlp_type,
                        unsigned dir = Outbound);
 
@@ -221,6 +224,16 @@ public:
    * \param addr  The address of the config space that should be setup.
    *
    * \return  The config space register set for the given config address.
+   *
+   * Config accesses below the root port go through outbound iATU regions
+   * (config windows) located in the config space region. The target of each
+   * window is remembered, so that consecutive accesses to the same function
+   * do not reprogram the iATU. If the core provides enough outbound regions,
+   * up to #Max_cfg_windows functions stay mapped at the same time.
+   *
+   * Functions on the bus directly below the root port are accessed with
+   * type-0 requests, functions on busses further down (e.g. behind a switch)
+   * with type-1 requests.
    */
   L4drivers::Register_block<32> cfg_regs(Cfg_addr addr);
 
@@ -285,6 +298,9 @@ public:
    */
   bool setup_rc();
 
+  int pm_resume() override;
+  void dump(int indent) const override;
+
 protected:
   /**
    * Lookup PCI capability offset in PCI bridge root complex block.
@@ -331,6 +347,39 @@ protected:
   unsigned _num_ob_windows = 0;
   l4_uint8_t _offs_cap_pcie;  ///< PCI config space offset of PCIe capability
 
+  /// Serializes config accesses, which share the config iATU viewport.
+  pthread_mutex_t _cfg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  enum
+  {
+    Max_cfg_windows  = 4,        ///< Maximum number of config windows
+    Cfg_window_min   = 0x10000,  ///< Minimum size of a config window
+    Cfg_window_none  = ~0U,      ///< Config window target not programmed
+  };
+
+  /// An outbound iATU region used for config accesses.
+  struct Cfg_window
+  {
+    L4drivers::Register_block<32> regs; ///< Mapping of the window
+    l4_uint32_t target = Cfg_window_none; ///< Programmed bus/devfn target
+  };
+
+  Cfg_window _cfg_win[Max_cfg_windows];
+  unsigned _num_cfg_windows = 1;
+  unsigned _cfg_win_next = 0;    ///< Window to be replaced next
+  l4_uint64_t _cfg_win_size = 0;
+  unsigned _cfg_accesses = 0;    ///< Config accesses below the root port
+  unsigned _cfg_win_misses = 0;  ///< Accesses that reprogrammed the iATU
+
+  /**
+   * Setup the config windows after the number of outbound iATU regions is
+   * known.
+   */
+  void init_cfg_windows(l4_addr_t cfg_va);
+
+  /// Forget the targets of all config windows.
+  void invalidate_cfg_windows();
+
 private:
   /**
    * Check whether the config space address belongs to a valid device
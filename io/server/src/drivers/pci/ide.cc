@@ -15,6 +15,8 @@ using namespace Hw::Pci;
 
 struct Pci_ide_drv : Driver
 {
+  char const *name() const override { return "ide"; }
+
   int probe(Dev *d) override
   {
     d_printf(DBG_DEBUG, "Found IDE device\n");
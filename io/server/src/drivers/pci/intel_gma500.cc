@@ -15,6 +15,8 @@ using namespace Hw::Pci;
 
 struct Pci_intel_gma500_drv : Driver
 {
+  char const *name() const override { return "intel_gma500"; }
+
   int probe(Dev *d) override
   {
     d_printf(DBG_DEBUG, "Found Intel gma500 device\n");
@@ -48,6 +48,8 @@ struct Pci_intel_i915_drv : Driver
     return hdr;
   }
 
+  char const *name() const override { return "intel_i915"; }
+
   int probe(Dev *d) override
   {
     d_printf(DBG_INFO, "Found Intel i915 device\n");
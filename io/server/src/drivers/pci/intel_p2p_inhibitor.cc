@@ -81,6 +81,8 @@ struct Intel_root_complex_p2p_inhibitor : Driver
       register_driver(0x8086, id);
   }
 
+  char const *name() const override { return "intel_rc_p2p"; }
+
   /**
    * This function configures the root complex such that requests are always
    * routed through the root complex and that there are no
@@ -184,6 +186,8 @@ struct Intel_root_port_p2p_inhibitor : Driver
       register_driver(0x8086, id);
   }
 
+  char const *name() const override { return "intel_rp_p2p"; }
+
   /**
    * This function configures the PCI root port such that it implements the
    * equivalent of PCI ACS source validation. For reference, please consult
@@ -15,6 +15,8 @@ using namespace Hw::Pci;
 
 struct Pci_marvell_91xx_quirk : Driver
 {
+  char const *name() const override { return "marvell_91xx"; }
+
   int probe(Dev *d) override
   {
     d_printf(DBG_DEBUG,
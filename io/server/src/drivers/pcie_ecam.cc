@@ -131,6 +131,13 @@ public:
   int cfg_read(Cfg_addr addr, l4_uint32_t *value, Cfg_width) override;
   int cfg_write(Cfg_addr addr, l4_uint32_t value, Cfg_width) override;
 
+  /// The config space window starts at bus 0 and covers 1 MiB per bus.
+  unsigned last_bus() const override
+  {
+    l4_uint64_t busses = l4_uint64_t(_cfg_size.val()) >> 20;
+    return busses ? cxx::min<l4_uint64_t>(busses - 1, 0xff) : 0;
+  }
+
   int int_map(int i) const { return _int_map[i]; }
 
 private:
@@ -179,9 +186,10 @@ public:
     unsigned slot = (cd->adr() >> 16);
     unsigned irq_nr = pd->int_map((pin + slot) & 3);
 
-    d_printf(DBG_DEBUG, "%s/%08x: Requesting IRQ%c at slot %d => IRQ %d\n",
-             cd->get_full_path().c_str(), cd->adr(),
-             (int)('A' + pin), slot, irq_nr);
+    if (dlevel(DBG_DEBUG))
+      d_printf(DBG_DEBUG, "%s/%08x: Requesting IRQ%c at slot %d => IRQ %d\n",
+               cd->get_full_path().c_str(), cd->adr(),
+               (int)('A' + pin), slot, irq_nr);
 
     child->del_flags(Resource::F_relative);
     child->start(irq_nr);
@@ -189,7 +189,7 @@ public:
   }
 };
 
-class Pcie_imx8_bridge : public Dwc_pcie
+class Pcie_imx8_bridge : public Dwc_pcie, public Hw::Async_init
 {
   // _regs_base + 0x050000: LPCG_PCIEX2_0
   L4drivers::Register_block<32> _hsio_lpcg_pciea;
@@ -326,6 +326,8 @@ public:
   explicit Pcie_imx8_bridge(int segment = 0, unsigned bus_nr = 0);
   void init() override;
   bool controller_host_init() override;
+  long async_init_wait() override;
+  void async_init_finish() override;
 
   bool link_up() override
   { return _regs[Port_logic::Debug1] & (1 << 4); }
@@ -381,8 +383,9 @@ Pci_irq_router_rs::request(Resource *parent, ::Device *pdev,
   unsigned slot = (cd->adr() >> 16);
   unsigned irq_nr = pd->int_map((pin + slot) & 3);
 
-  d_printf(DBG_DEBUG, "%s: Requesting IRQ%c at slot %d => IRQ %d\n",
-           cd->get_full_path().c_str(), (int)('A' + pin), slot, irq_nr);
+  if (dlevel(DBG_DEBUG))
+    d_printf(DBG_DEBUG, "%s: Requesting IRQ%c at slot %d => IRQ %d\n",
+             cd->get_full_path().c_str(), (int)('A' + pin), slot, irq_nr);
 
   child->del_flags(Resource::F_relative);
   child->start(irq_nr);
@@ -422,6 +425,13 @@ Pcie_imx8_bridge::init()
   // enable ltssm: APP_LTSSM_ENABLE=1
   _hsio_csr_pciea[Pciex1_ctrl2].set(Pciex1_ctrl2_app_ltssm_enable);
 
+  // link training continues in the background
+  start_async_init(this, L4VBUS_TIMING_LINK_UP);
+}
+
+long
+Pcie_imx8_bridge::async_init_wait()
+{
   wait_link_up();
 
   // DEFAULT_GEN2_N_FTS=3 (number of fast training sequences during link
@@ -429,6 +439,12 @@ Pcie_imx8_bridge::init()
   _regs[Gen2].modify(0, 3U << 0);
 
   wait_link_up();
+  return link_up();
+}
+
+void
+Pcie_imx8_bridge::async_init_finish()
+{
   d_printf(DBG_WARN, "%s: Link %s\n", name(), link_up() ? "up" : "DOWN");
 
   typedef Hw::Pci::Irq_router_res<Pci_irq_router_rs> Irq_res;
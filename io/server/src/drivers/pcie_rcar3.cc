@@ -59,6 +59,8 @@
 #include <pci-root.h>
 #include "resource_provider.h"
 #include "pcie_rcar3_regs.h"
+#include "timing_stats.h"
+#include "utils.h"
 
 #include <l4/drivers/hw_mmio_register_block>
 #include <l4/re/error_helper>
@@ -78,7 +80,8 @@ using namespace Pcie_rcar3_regs;
 
 class Rcar3_pcie_bridge
 : public Hw::Device,
-  public Hw::Pci::Root_bridge
+  public Hw::Pci::Root_bridge,
+  public Hw::Async_init
 {
 public:
   Rcar3_pcie_bridge(int segment = 0, unsigned bus_nr = 0)
@@ -102,6 +105,13 @@ public:
     register_property("irq", &_interrupt);
 
     set_name("Rcar3 PCIe root bridge");
+
+    // batches hold the lock across the individual accesses
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&_cfg_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
   }
 
   typedef Hw::Pci::Cfg_addr Cfg_addr;
@@ -111,13 +121,20 @@ public:
 
   int cfg_read(Cfg_addr addr, l4_uint32_t *value, Cfg_width) override;
   int cfg_write(Cfg_addr addr, l4_uint32_t value, Cfg_width) override;
+  void cfg_batch_begin(Cfg_addr addr) override;
+  int cfg_batch_end() override;
 
   int interrupt() const { return _interrupt; }
 
 private:
   int host_init();
+  int link_init();
+  long async_init_wait() override;
+  void async_init_finish() override;
   int access_enable(Cfg_addr addr, Cfg_width width);
   void access_disable(Cfg_addr addr);
+  bool access_error();
+  int batch_flush();
   void alloc_msi_page(void **virt, l4_addr_t *phys);
   void init_msi();
 
@@ -140,6 +157,27 @@ private:
   L4drivers::Register_block<32> _regs;
 
   L4Re::Util::Unique_cap<L4Re::Dataspace> _ds_msi;
+
+  // Result of link_init(), valid once async_init_wait() returned.
+  int _link_state = -L4_ENXIO;
+
+  // Serializes config accesses, which go through shared indirect registers.
+  pthread_mutex_t _cfg_lock;
+
+  /**
+   * State of the current batch of config accesses.
+   *
+   * Within a batch, PCIECCTLR stays enabled for one function and only
+   * PCIECAR is updated when the register offset changes. Errors are only
+   * checked when the function changes or the batch ends.
+   */
+  struct Batch
+  {
+    unsigned depth = 0;   ///< Nesting level, 0 if no batch is active
+    bool active = false;  ///< PCIECCTLR enabled for the function in `car`
+    bool error = false;   ///< An error was detected within this batch
+    l4_uint32_t car = 0;  ///< Currently programmed PCIECAR value
+  } _batch;
 };
 
 // return upper 32-bit part of a 64-bit value
@@ -271,6 +309,18 @@ Rcar3_pcie_bridge::host_init()
   // PCIe mode: Type 01 (root port)
   _regs[Pcie_msr] = Pcie_msr_rootport;
 
+  return 0;
+}
+
+/**
+ * Finish the controller setup once the PHY is ready and wait for the link.
+ *
+ * Only accesses the controller registers, so it can run concurrently to the
+ * rest of io.
+ */
+int
+Rcar3_pcie_bridge::link_init()
+{
   // wait for PHY ready
   for (unsigned i = 0; i < 20 && !(_regs[Pcie_physr] & 1); ++i)
     l4_sleep(10);
@@ -388,6 +438,23 @@ Rcar3_pcie_bridge::host_init()
   return -L4_ENXIO;
 }
 
+/**
+ * Check the error registers for the last config access.
+ */
+bool
+Rcar3_pcie_bridge::access_error()
+{
+  // check errors for "unsupported request"
+  if (_regs[Pcie_errfr] & Pcie_errfr_rcvurcpl)
+    return true;
+
+  // check for "master/target abort"
+  if (_regs[Pciconf1] & (Pciconf1_rma|Pciconf1_rta))
+    return true;
+
+  return false;
+}
+
 /**
  * Helper for cfg_read()/cfg_write().
  */
@@ -404,13 +471,31 @@ Rcar3_pcie_bridge::access_enable(Cfg_addr addr, Cfg_width width)
   if (addr.bus() == 0)
     return 0;
 
-  _regs[Pcie_errfr].modify(0, 0); // clear errors
-
-  _regs[Pcie_car] = ((addr.bus() & 0xff) << 24)
+  l4_uint32_t car = ((addr.bus() & 0xff) << 24)
                   | ((addr.dev() & 0x1f) << 19)
                   | ((addr.fn()  &    7) << 16)
                   | reg;
 
+  if (_batch.active)
+    {
+      // same function: just select the register
+      if ((_batch.car & 0xffff0000) == (car & 0xffff0000))
+        {
+          if (_batch.car != car)
+            {
+              _regs[Pcie_car] = car;
+              _batch.car = car;
+            }
+          return 0;
+        }
+
+      batch_flush();
+    }
+
+  _regs[Pcie_errfr].modify(0, 0); // clear errors
+
+  _regs[Pcie_car] = car;
+
   if (addr.dev() != 0)
     // type-1 access (bus+dev+fn+reg)
     // Actually that makes only sense if a PCIe-to-PCIe bridge is plugged into
@@ -420,12 +505,15 @@ Rcar3_pcie_bridge::access_enable(Cfg_addr addr, Cfg_width width)
     // type-0 access (only fn+reg)
     _regs[Pcie_cctlr] = Pcie_cctlr_ccie;
 
-  // check errors for "unsupported request"
-  if (_regs[Pcie_errfr] & Pcie_errfr_rcvurcpl)
-    return -EIO;
+  if (_batch.depth)
+    {
+      // errors are checked at the end of the batch
+      _batch.active = true;
+      _batch.car = car;
+      return 0;
+    }
 
-  // check for "master/target abort"
-  if (_regs[Pciconf1] & (Pciconf1_rma|Pciconf1_rta))
+  if (access_error())
     return -EIO;
 
   return 0;
@@ -437,10 +525,62 @@ Rcar3_pcie_bridge::access_enable(Cfg_addr addr, Cfg_width width)
 void
 Rcar3_pcie_bridge::access_disable(Cfg_addr addr)
 {
-  if (addr.bus() != 0)
+  if (addr.bus() != 0 && !_batch.active)
     _regs[Pcie_cctlr] = 0;
 }
 
+/**
+ * Check for errors of the function accessed within the current batch and
+ * disable the config access.
+ *
+ * \retval 0     No error.
+ * \retval -EIO  An access to the function failed.
+ */
+int
+Rcar3_pcie_bridge::batch_flush()
+{
+  if (!_batch.active)
+    return 0;
+
+  _batch.active = false;
+
+  bool err = access_error();
+  _regs[Pcie_cctlr] = 0;
+
+  if (err)
+    {
+      _batch.error = true;
+      d_printf(DBG_DEBUG, "%s: config access error in batch for %02x:%02x.%x\n",
+               name(), _batch.car >> 24, (_batch.car >> 19) & 0x1f,
+               (_batch.car >> 16) & 7);
+      return -EIO;
+    }
+
+  return 0;
+}
+
+void
+Rcar3_pcie_bridge::cfg_batch_begin(Cfg_addr)
+{
+  pthread_mutex_lock(&_cfg_lock);
+  ++_batch.depth;
+}
+
+int
+Rcar3_pcie_bridge::cfg_batch_end()
+{
+  int r = 0;
+  if (--_batch.depth == 0)
+    {
+      batch_flush();
+      r = _batch.error ? -EIO : 0;
+      _batch.error = false;
+    }
+
+  pthread_mutex_unlock(&_cfg_lock);
+  return r;
+}
+
 void
 Rcar3_pcie_bridge::alloc_msi_page(void **virt, l4_addr_t *phys)
 {
@@ -496,6 +636,7 @@ Rcar3_pcie_bridge::cfg_read(Cfg_addr addr, l4_uint32_t *value, Cfg_width width)
 {
   uint32_t v;
 
+  Pthread_mutex_guard g(&_cfg_lock);
   if (access_enable(addr, width) < 0)
     v = 0xffffffff;
   else
@@ -543,6 +684,7 @@ Rcar3_pcie_bridge::cfg_write(Cfg_addr addr, l4_uint32_t value, Cfg_width width)
            name(), addr.bus(), addr.dev(), addr.fn(),  addr.reg(), 8 << width,
            2 << width, value & cfg_o_to_mask(width));
 
+  Pthread_mutex_guard g(&_cfg_lock);
   if (access_enable(addr, width) < 0)
     return -EIO;
 
@@ -584,6 +726,23 @@ Rcar3_pcie_bridge::init()
   if (host_init())
     return;
 
+  // PHY and link setup continue in the background
+  start_async_init(this, L4VBUS_TIMING_LINK_UP);
+}
+
+long
+Rcar3_pcie_bridge::async_init_wait()
+{
+  _link_state = link_init();
+  return _link_state == L4_EOK;
+}
+
+void
+Rcar3_pcie_bridge::async_init_finish()
+{
+  if (_link_state != L4_EOK)
+    return;
+
   d_printf(DBG_INFO, "%s: new device.\n", name());
 
   if (Enable_msi)
@@ -632,7 +791,10 @@ Rcar3_pcie_bridge::init()
   ir->set_id("IRQR");
   add_resource_rq(ir);
 
+  l4_uint64_t start = Timing_stats::now_us();
   discover_bus(this, this);
+  d_printf(DBG_INFO, "%s: bus discovery took %llu us.\n", name(),
+           Timing_stats::now_us() - start);
 
   Hw::Device::init();
 
@@ -295,7 +295,7 @@ public:
   L4Re::Util::Dbg log{4, "tegra", "pwm"};
 };
 
-class Pcie_tegra194_bridge : public Dwc_pcie
+class Pcie_tegra194_bridge : public Dwc_pcie, public Hw::Async_init
 {
   using Clk_id = Tegra_bpmp::Mrq_clk::Clk_id;
   using Reset_id = Tegra_bpmp::Mrq_reset::Reset_id;
@@ -365,6 +365,9 @@ public:
 
 private:
   bool do_init();
+  long async_init_wait() override;
+  void async_init_finish() override;
+  bool do_finish();
   // Called by Dwc_pcie::host_init().
   bool controller_host_init() override;
 
@@ -375,6 +378,9 @@ private:
   L4drivers::Register_block<32> _phy0;    ///< PHY0 registers
   L4drivers::Register_block<32> _phy1;    ///< PHY1 registers
 
+  /// Result of async_init_wait().
+  bool _link_up = false;
+
   Tegra_hsp hsp;
   Tegra_bpmp bpmp{&hsp};
   Tegra_pwm pwm{&bpmp};
@@ -435,9 +441,10 @@ public:
 
     unsigned irq_nr = pd->int_map(map_idx);
 
-    d_printf(DBG_DEBUG, "%s/%08x: Requesting IRQ%c at slot %d => IRQ %d\n",
-             cd->get_full_path().c_str(), cd->adr(),
-             (int)('A' + pin), slot, irq_nr);
+    if (dlevel(DBG_DEBUG))
+      d_printf(DBG_DEBUG, "%s/%08x: Requesting IRQ%c at slot %d => IRQ %d\n",
+               cd->get_full_path().c_str(), cd->adr(),
+               (int)('A' + pin), slot, irq_nr);
 
     child->del_flags(Resource::F_relative);
     child->start(irq_nr);
@@ -496,7 +503,14 @@ Pcie_tegra194_bridge::Pcie_tegra194_bridge(int segment, unsigned bus_nr)
 
 void Pcie_tegra194_bridge::init()
 {
-  static_cast<void>(do_init());
+  // link training continues in the background
+  if (do_init())
+    start_async_init(this, L4VBUS_TIMING_LINK_UP);
+}
+
+void Pcie_tegra194_bridge::async_init_finish()
+{
+  static_cast<void>(do_finish());
 }
 
 bool Pcie_tegra194_bridge::do_init()
@@ -744,6 +758,18 @@ bool Pcie_tegra194_bridge::do_init()
   if (!Dwc_pcie::setup_rc())
     return false;
 
+  return true;
+}
+
+/**
+ * Train the link. Only accesses the controller registers, so it can run
+ * concurrently to the rest of io.
+ *
+ * \retval 1  The link is up.
+ * \retval 0  The link is still down.
+ */
+long Pcie_tegra194_bridge::async_init_wait()
+{
   auto const *kip = l4re_kip();
   auto start_wait = l4_kip_clock(kip);
   unsigned i;
@@ -775,9 +801,18 @@ bool Pcie_tegra194_bridge::do_init()
     {
       error("Link still down after %llu ms!\n",
             (l4_kip_clock(kip) - start_wait) / 1000);
-      return false;
+      return 0;
     }
 
+  _link_up = true;
+  return 1;
+}
+
+bool Pcie_tegra194_bridge::do_finish()
+{
+  if (!_link_up)
+    return false;
+
   l4_uint32_t rate;
   // PCIe capability: Link Status Register
   switch (_regs.r<16>(_offs_cap_pcie + 0x12) & 0xf)
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include "hw_async_init.h"
+#include "hw_device.h"
+#include "debug.h"
+#include "timing_stats.h"
+#include "worker_pool.h"
+
+namespace Hw {
+
+struct Async_init::Job : Worker_pool::Job
+{
+  Async_init *obj;
+  Device *dev;
+  unsigned timing_category;
+
+  Job(Async_init *obj, Device *dev, unsigned timing_category)
+  : obj(obj), dev(dev), timing_category(timing_category)
+  {}
+
+  void run() override
+  {
+    l4_uint64_t start = Timing_stats::now_us();
+    long v = obj->async_init_wait();
+    Timing_stats::record(timing_category, dev->get_full_path(),
+                         Timing_stats::now_us() - start, v);
+  }
+};
+
+unsigned Async_init::_pending;
+unsigned Async_init::_workers = 4;
+
+Async_init::Job_map &
+Async_init::jobs()
+{
+  static Job_map _jobs;
+  return _jobs;
+}
+
+void
+Async_init::start_async_init(Device *dev, unsigned timing_category)
+{
+  Job *job = new Job(this, dev, timing_category);
+  jobs()[dev] = job;
+  ++_pending;
+
+  // without workers the wait runs when the device is completed
+  if (!_workers)
+    return;
+
+  Worker_pool::reserve(_workers);
+  Worker_pool::submit(job);
+}
+
+void
+Async_init::finish(Job *job)
+{
+  // the job is already removed from jobs(), so lookups of the children of
+  // the device during async_init_finish() do not end up here again
+  --_pending;
+
+  // runs the wait here if no worker picked it up yet
+  Worker_pool::wait(job);
+
+  d_printf(DBG_DEBUG, "%s: completing asynchronous initialization\n",
+           job->dev->name());
+  job->obj->async_init_finish();
+  delete job;
+}
+
+void
+Async_init::complete_pending(Device const *dev)
+{
+  auto i = jobs().find(dev);
+  if (i == jobs().end())
+    return;
+
+  Job *job = i->second;
+  jobs().erase(i);
+  finish(job);
+}
+
+void
+Async_init::complete_all(std::vector<Device *> *completed)
+{
+  while (!jobs().empty())
+    {
+      Job *job = jobs().begin()->second;
+      jobs().erase(jobs().begin());
+      if (completed)
+        completed->push_back(job->dev);
+      finish(job);
+    }
+}
+
+}
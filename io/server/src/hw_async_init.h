@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <l4/vbus/vbus_platform_stats>
+
+#include <map>
+#include <vector>
+
+namespace Hw {
+
+class Device;
+
+/**
+ * Asynchronous initialization of a hardware device.
+ *
+ * Devices with long waits during their initialization, e.g. for PCIe link
+ * training, split their init() into three steps:
+ *
+ * 1. The start in init(), running in the main thread, which ends with
+ *    start_async_init().
+ * 2. async_init_wait(), running on the Worker_pool shared with the power
+ *    management (see set_workers()). As it runs concurrently to the rest of
+ *    io and to the waits of other devices it must only touch registers
+ *    private to the device.
+ * 3. async_init_finish(), running in the main thread, which completes the
+ *    initialization, e.g. discovers the devices behind a PCIe controller.
+ *
+ * The last step is deferred until complete() is called for the device, i.e.
+ * when the configuration looks at the children of the device (e.g. when
+ * matching devices for a virtual bus) or a virtual bus references it, or
+ * until complete_all() is called. So the waits of several devices overlap
+ * with each other and with the processing of the configuration, and devices
+ * not used by any virtual bus are completed only after io is ready.
+ *
+ * The children of a device are only discovered and initialized in
+ * async_init_finish(), so the initialization of a child never starts before
+ * the one of its parent is complete.
+ */
+class Async_init
+{
+public:
+  /**
+   * Complete the pending initialization of `dev`, if any.
+   *
+   * Waits for async_init_wait() of `dev` and runs its async_init_finish().
+   */
+  static void complete(Device const *dev)
+  {
+    if (_pending)
+      complete_pending(dev);
+  }
+
+  /**
+   * Complete all pending initializations.
+   *
+   * \param[out] completed  Optional list the completed devices are added to.
+   */
+  static void complete_all(std::vector<Device *> *completed = nullptr);
+
+  /**
+   * Set the number of worker threads running async_init_wait().
+   *
+   * The threads come from the Worker_pool, which grows to the largest number
+   * requested by any of its users.
+   *
+   * With 0 workers the waits run in the main thread when a device is
+   * completed. Must be called before the first device is initialized.
+   */
+  static void set_workers(unsigned workers) { _workers = workers; }
+
+  /// The number of worker threads set with set_workers().
+  static unsigned workers() { return _workers; }
+
+protected:
+  /**
+   * Queue async_init_wait() for a worker thread.
+   *
+   * \param dev              The device being initialized.
+   * \param timing_category  Category (see L4vbus_timing_category) used to
+   *                         record the duration of async_init_wait().
+   */
+  void start_async_init(Device *dev, unsigned timing_category);
+
+  /**
+   * Wait for the device to become ready.
+   *
+   * \return Value recorded with the duration, e.g. whether a link is up.
+   */
+  virtual long async_init_wait() = 0;
+
+  /// Complete the initialization after async_init_wait() returned.
+  virtual void async_init_finish() = 0;
+
+  virtual ~Async_init() = 0;
+
+private:
+  struct Job;
+  typedef std::map<Device const *, Job *> Job_map;
+
+  static Job_map &jobs();
+  static void complete_pending(Device const *dev);
+  static void finish(Job *job);
+
+  static unsigned _pending;
+  static unsigned _workers;
+};
+
+inline Async_init::~Async_init() {}
+
+}
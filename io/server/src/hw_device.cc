@@ -8,9 +8,12 @@
 #include "hw_device.h"
 #include "cfg.h"
 #include "debug.h"
+#include "timing_stats.h"
 
 namespace Hw {
 
+unsigned long Device::_generation;
+
 bool
 Device::setup()
 {
@@ -67,7 +70,11 @@ Device::pm_init()
   printf("Hw::Device::plug(this=%p, name='%s', hid='%s')\n",
          this, name(), hid());
 #endif
+  l4_uint64_t start = Timing_stats::now_us();
   allocate_pending_resources();
+  Timing_stats::record_startup_step(L4VBUS_STARTUP_ALLOC, start,
+                                    [this]{ return get_full_path(); });
+
   if (!setup())
     {
       pm_set_state(Pm_failed);
@@ -93,7 +100,10 @@ Device::init()
     if (!dma_domain() && parent())
       parent()->dma_domain_for(this);
 
+  l4_uint64_t start = Timing_stats::now_us();
   int r = pm_init();
+  Timing_stats::record_startup_step(L4VBUS_STARTUP_INIT, start,
+                                    [this]{ return get_full_path(); });
   if (r < 0)
     {
       d_printf(DBG_ERR, "error: failed to setup device: %s\n", name());
@@ -134,12 +144,90 @@ Device::resource_allocated(Resource const *r) const
 }
 
 
+namespace {
+
+/// The first device added with `key`.
+template<typename K>
+Device *
+index_find(std::multimap<K, Device *> const &idx, K const &key)
+{
+  auto i = idx.lower_bound(key);
+  return (i != idx.end() && i->first == key) ? i->second : 0;
+}
+
+}
+
+template<typename K>
+void
+Device::reindex(std::multimap<K, Device *> *idx, K const &old, K const &key,
+                Device *c)
+{
+  auto r = idx->equal_range(old);
+  for (auto i = r.first; i != r.second; ++i)
+    if (i->second == c)
+      {
+        idx->erase(i);
+        break;
+      }
+
+  idx->emplace(key, c);
+}
+
+int
+Device::Adr_property::set(int k, l4_int64_t i)
+{
+  l4_uint32_t old = _dev->adr();
+  int r = Int_property::set(k, i);
+  if (r == 0)
+    if (Device *p = _dev->parent())
+      reindex(&p->_child_adr, old, _dev->adr(), _dev);
+
+  return r;
+}
+
+void
+Device::add_child(Device *c)
+{
+  Device_tree_mixin<Device>::add_child(c);
+  if (c->parent() != this)
+    return;
+
+  _child_adr.emplace(c->adr(), c);
+  _child_uid.emplace(c->uid(), c);
+  _child_name.emplace(c->_name, c);
+  ++_generation;
+}
+
+void
+Device::set_name(std::string const &name)
+{
+  if (Device *p = parent())
+    reindex(&p->_child_name, _name, name, this);
+
+  _name = name;
+}
+
+void
+Device::set_uid(l4_umword_t uid)
+{
+  if (Device *p = parent())
+    reindex(&p->_child_uid, _uid, uid, this);
+
+  _uid = uid;
+}
+
+Device *
+Device::find_by_name(std::string const &name) const
+{
+  return index_find(_child_name, name);
+}
+
 Device *
 Device::get_child_dev_adr(l4_uint32_t adr, bool create)
 {
-  for (Device *c = children(); c; c = c->next())
-    if (c->adr() == adr)
-      return c;
+  Async_init::complete(this);
+  if (Device *c = index_find(_child_adr, adr))
+    return c;
 
   if (!create)
     return 0;
@@ -152,9 +240,9 @@ Device::get_child_dev_adr(l4_uint32_t adr, bool create)
 Device *
 Device::get_child_dev_uid(l4_umword_t uid, l4_uint32_t adr, bool create)
 {
-  for (Device *c = children(); c; c = c->next())
-    if (c->uid() == uid)
-      return c;
+  Async_init::complete(this);
+  if (Device *c = index_find(_child_uid, uid))
+    return c;
 
   if (!create)
     return 0;
@@ -182,6 +270,19 @@ Device::match_cid(cxx::String const &cid) const
   return false;
 }
 
+bool
+Device::has_cid_prefix(cxx::String const &prefix) const
+{
+  if (cxx::String(hid()).starts_with(prefix))
+    return true;
+
+  for (auto const &c: _cid)
+    if (cxx::String(c.c_str(), c.size()).starts_with(prefix))
+      return true;
+
+  return false;
+}
+
 void
 Device::dump(int indent) const
 {
@@ -12,11 +12,13 @@
 #include "type_matcher.h"
 #include "hw_device_client.h"
 #include "dma_domain.h"
+#include "hw_async_init.h"
 #include <l4/cxx/avl_map>
 
 #include <cerrno>
 
 #include <functional>
+#include <map>
 #include <string>
 #include <vector>
 #include <l4/cxx/unique_ptr>
@@ -90,9 +92,22 @@ class Device :
   public Pm
 {
 private:
+  /// The `adr` property, keeps the address index of the parent up to date.
+  class Adr_property : public Int_property
+  {
+  public:
+    Adr_property(Device *dev, l4_int64_t adr) : Int_property(adr), _dev(dev) {}
+
+    using Int_property::set;
+    int set(int k, l4_int64_t i) override;
+
+  private:
+    Device *_dev;
+  };
+
   unsigned long _ref_cnt = 0;
   l4_umword_t _uid       = reinterpret_cast<l4_umword_t>(this);
-  Int_property _adr      = ~0;
+  Adr_property _adr{this, ~0};
   Int_property _flags    = 0;
 
 public:
@@ -112,10 +127,10 @@ public:
   void inc_ref_count() { ++_ref_cnt; }
   void dec_ref_count() { --_ref_cnt; }
 
-  Device(l4_umword_t uid, l4_uint32_t adr) : _uid(uid), _adr(adr)
+  Device(l4_umword_t uid, l4_uint32_t adr) : _uid(uid), _adr(this, adr)
   { register_properties(); }
 
-  explicit Device(l4_uint32_t adr) : _adr(adr)
+  explicit Device(l4_uint32_t adr) : _adr(this, adr)
   { register_properties(); }
 
   Device()
@@ -140,6 +155,13 @@ public:
   Device *get_child_dev_adr(l4_uint32_t adr, bool create = false);
   Device *get_child_dev_uid(l4_umword_t uid, l4_uint32_t adr, bool create = false);
 
+  /**
+   * Find a child device by name.
+   *
+   * \return The first child added with this name, or NULL if none.
+   */
+  Device *find_by_name(std::string const &name) const;
+
   Device *parent() const override { return _dt.parent(); }
   Device *children() const override { return _dt.children(); }
   Device *next() const override { return _dt.next(); }
@@ -174,6 +196,8 @@ public:
   int pm_init() override;
   int pm_suspend() override;
   int pm_resume() override;
+  Pm *pm_parent() const override { return parent(); }
+  std::string pm_name() const override { return get_full_path(); }
 
   virtual void init();
   Status status() const { return _sta; }
@@ -189,23 +213,38 @@ public:
    */
   char const *hid() const override { return _hid.val().c_str(); }
 
-  void set_name(std::string const &name) { _name = name; }
+  void set_name(std::string const &name);
   bool set_name_if_empty(std::string const &name)
   {
     if (!_name.empty())
       return false;
 
-    _name = name;
+    set_name(name);
     return true;
   }
 
   void set_hid(char const *hid) { _hid.set(-1, hid); }
-  void set_uid(l4_umword_t uid) { _uid = uid; }
+  void set_uid(l4_umword_t uid);
 
-  void add_cid(char const *cid) { _cid.push_back(cid); }
+  void add_cid(char const *cid)
+  {
+    _cid.push_back(cid);
+    ++_generation;
+  }
+
+  void add_child(Device *c) override;
+
+  /**
+   * Counter incremented whenever a device is added to a device tree or gets
+   * a compatible ID, used to invalidate lookup indexes.
+   */
+  static unsigned long generation() { return _generation; }
 
   bool match_cid(cxx::String const &cid) const override;
 
+  /// Check whether the HID or a compatible ID starts with `prefix`.
+  bool has_cid_prefix(cxx::String const &prefix) const;
+
   void add_client(Device_client *client);
   void check_conflicts() const;
 
@@ -276,6 +315,10 @@ public:
 private:
   typedef std::vector<std::string> Cid_list;
 
+  template<typename K>
+  static void reindex(std::multimap<K, Device *> *idx, K const &old,
+                      K const &key, Device *c);
+
   void register_properties()
   {
     register_property("hid", &_hid);
@@ -300,6 +343,13 @@ private:
   /// DMA domain that **must** be used for all children of this device.
   Dma_domain *_downstream_dma_domain = 0;
   Dma_domain_factory *_dma_domain_factory = 0;
+
+  /// Indexes of the children, equal keys are kept in the order of addition.
+  std::multimap<l4_uint32_t, Device *> _child_adr;
+  std::multimap<l4_umword_t, Device *> _child_uid;
+  std::multimap<std::string, Device *> _child_name;
+
+  static unsigned long _generation;
 };
 
 
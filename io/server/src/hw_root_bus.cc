@@ -7,10 +7,12 @@
  */
 
 #include "cfg.h"
+#include "config_snapshot.h"
 #include "debug.h"
 #include "hw_root_bus.h"
 #include "phys_space.h"
 #include "resource.h"
+#include "resource_provider.h"
 #include "pm.h"
 #include <l4/sys/platform_control>
 #include "server.h"
@@ -98,6 +100,9 @@ public:
     d_printf(DBG_ERR, "internal error: cannot assign to root Root_mmio_rs\n");
   }
 
+  l4_uint64_t max_alloc_block(Resource const *) override
+  { return Phys_space::space.max_aligned_block(); }
+
   bool adjust_children(Resource *) override
   {
     d_printf(DBG_ERR, "internal error: cannot adjust root Root_mmio_rs\n");
@@ -124,37 +129,78 @@ Root_mmio_rs::request(Resource *parent, Device *, Resource *child, Device *)
 }
 
 
+/**
+ * Allocate a resource directly below the root bus.
+ *
+ * The space comes from the MMIO apertures declared to Phys_space, KIP memory
+ * and ranges requested by other devices are never handed out.
+ */
 bool
-Root_mmio_rs::alloc(Resource * /*parent*/, Device *, Resource * /*child*/,
+Root_mmio_rs::alloc(Resource *parent, Device *, Resource *child,
                     Device *, bool /*resize*/)
 {
-  d_printf(DBG_ERR, "internal error: cannot alloc from Root_mmio_rs\n");
-  return false;
+  Resource::Size align = cxx::max<Resource::Size>(child->alignment(),
+                                                  L4_PAGESIZE - 1);
+  Resource::Size size = child->size();
+  if (size > ~Phys_space::Phys_region::Addr(0)
+      || align > ~Phys_space::Phys_region::Addr(0))
+    return false;
+
+  Phys_space::Phys_region phys =
+    Phys_space::space.alloc(size, align,
+                            Resource_provider::fits_above_4g(child));
+  if (!phys.valid())
+    {
+      d_printf(DBG_WARN, "WARNING: no physical space for resource\n");
+      if (dlevel(DBG_WARN))
+        child->dump();
+      return false;
+    }
+
+  child->start(phys.start());
+  child->parent(parent);
+
+  if (child->provided())
+    child->provided()->adjust_children(child);
 
-//  Resource::Size align = cxx::max<Resource::Size>(child->alignment(),  L4_PAGESIZE - 1);
-//  Phys_space::Phys_region phys = Phys_space::space.alloc(child->size(), align);
-//  if (!phys.valid())
-//    {
-//#if 0
-//      printf("ERROR: could not reserve physical space for resource\n");
-//      r->dump();
-//#endif
-//      child->disable();
-//      return false;
-//    }
-//
-//  child->start(phys.start());
-//  child->parent(parent);
-//
-//  if (dlevel(DBG_DEBUG))
-//    {
-//      printf("allocated resource: ");
-//      child->dump();
-//    }
-//  return true;
+  if (dlevel(DBG_DEBUG))
+    {
+      printf("allocated resource: ");
+      child->dump();
+    }
+  return true;
 }
 
 
+/**
+ * Property of the root bus declaring MMIO apertures for Root_mmio_rs::alloc().
+ */
+class Mmio_aperture_property : public Resource_property
+{
+public:
+  using Resource_property::set;
+  int set(int k, Resource *r) override
+  {
+    if (k != -1 || !r || r->type() != Resource::Mmio_res)
+      return -EINVAL;
+
+    if (r->end() > ~Phys_space::Phys_region::Addr(0))
+      {
+        d_printf(DBG_ERR, "error: MMIO aperture exceeds the address space\n");
+        return -ERANGE;
+      }
+
+    if (!Phys_space::space.add_aperture(
+          Phys_space::Phys_region(r->start(), r->end())))
+      return -EINVAL;
+
+    // the snapshot does not record apertures, without Lua they would be lost
+    Config_snapshot::get()->unsupported("declares MMIO apertures");
+    return 0;
+  }
+};
+
+
 // --- Root DMA domain space -----------------------------------------------
 class Root_dma_domain_rs : public Resource_space
 {
@@ -266,6 +312,8 @@ Root_bus::Root_bus(char const *name)
   r = new Root_resource(Resource::Dma_domain_res, new Root_dma_domain_rs());
   r->set_id("DMAD");
   add_resource(r);
+
+  register_property("mmio_aperture", new Mmio_aperture_property());
 }
 
 /**
@@ -232,21 +232,32 @@ function Io.Dt.Range(start, stop)
   return { range = true, start, stop }
 end
 
-function Io.Dt.match(self, ...)
+-- Compile compatible IDs for match(). Use this when matching the same IDs
+-- many times, e.g. Io.system_bus():match(Io.Dt.cid_matcher("PCI/CC_02")).
+function Io.Dt.cid_matcher(...)
   local cids = {...}
   for t,v in pairs(Io.Dt.PCI_cc) do
     for i, cid in ipairs(cids) do
       cids[i] = cid:gsub("(PCI/"..t..")", "PCI/" .. v)
     end
   end
+  return Io.cid_matcher(table.unpack(cids))
+end
 
-  local devs = {}
-  for d in self:devices(Io.Dt.MAX_DEPTH) do
-    if d:match_cids(table.unpack(cids)) then
-      devs[#devs+1] = d
-    end
+-- Return all devices below and including self matching any of the given
+-- compatible IDs, or the IDs of a matcher from Io.Dt.cid_matcher().
+function Io.Dt.match(self, ...)
+  local m = ...
+  if type(m) == "string" then
+    m = Io.Dt.cid_matcher(...)
   end
-  return devs
+  if not Io.swig_instance_of(self, "Hw::Device *") then
+    error("match() needs a hardware device", 2)
+  end
+  if m == nil then
+    return {}
+  end
+  return Io.match_devices(self, m)
 end
 
 function Io.Dt.device(self, path)
@@ -316,6 +327,17 @@ local function set_device_property(dev, name, idx, val)
   end
 end
 
+-- Set a property of a device or of each device in a list, e.g. the result of
+-- match().
+function Io.Dt.set_property(devs, name, val)
+  if type(devs) ~= "table" then
+    devs = { devs }
+  end
+  for _, d in ipairs(devs) do
+    set_device_property(d, name, -1, val)
+  end
+end
+
 local function handle_device_member(dev, val, name)
   local vtype = type(val)
   if name == "compatible" then
@@ -426,6 +448,15 @@ setmetatable(Io.Hw, { __index = function (self, t)
   end
 end})
 
+-- Declare a physical address range where MMIO resources left unassigned by
+-- the firmware may be placed. Must be called before adding the devices.
+function Io.add_mmio_aperture(start, _end)
+  local r = Io.hw_bus:property("mmio_aperture"):set(-1, Io.Res.mmio(start, _end))
+  if r < 0 then
+    error(string.format("could not add MMIO aperture %x-%x", start, _end), 2)
+  end
+end
+
 function Io.hw_add_devices(data)
   local sb = Io.hw_bus
   local dtype = type(data)
@@ -103,6 +103,7 @@ Msi_irq_pin::free_msi()
 
   Msi_allocator::get().clear(p & ~L4::Icu::F_msi);
   d_printf(DBG_ALL, "free global MSI %u\n", p & ~L4::Icu::F_msi);
+  _info_cache.valid = false;
   // reset the internal IRQ number to 0
   _idx = 0;
 }
@@ -166,9 +167,19 @@ Msi_irq_pin::msi_info(Msi_src *src, l4_icu_msi_info_t *info)
   if (res < 0)
     return res;
 
+  if (_info_cache.valid && _info_cache.src_id == si)
+    {
+      *info = _info_cache.info;
+      return src->map_msi_ctrl(info->msi_addr, &info->msi_addr);
+    }
+
   res = Kernel_irq_pin::_msi_info(si, info);
   if (res < 0)
     return res;
 
+  _info_cache.valid = true;
+  _info_cache.src_id = si;
+  _info_cache.info = *info;
+
   return src->map_msi_ctrl(info->msi_addr, &info->msi_addr);
 }
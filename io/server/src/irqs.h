@@ -209,6 +209,26 @@ private:
     cxx::Bitmap_base _bitmap;
   };
 
+  /**
+   * Last MSI info returned by the system ICU for this MSI.
+   *
+   * Clients setting up MSI-X tables usually query the same vector for the
+   * same source repeatedly. The kernel-provided info only depends on the
+   * MSI and the source ID, so it is kept per source ID until free_msi() is
+   * called. Unlike the address of an Msi_src object the source ID cannot
+   * be reused by an unrelated source. The address translation via
+   * Msi_src::map_msi_ctrl() is done on every query, as it depends on the
+   * DMA space of the source.
+   */
+  struct Info_cache
+  {
+    bool valid = false;
+    l4_uint64_t src_id;
+    l4_icu_msi_info_t info;
+  };
+
+  Info_cache _info_cache;
+
   void free_msi();
   int alloc_msi();
 };
@@ -2967,21 +2967,17 @@ SWIGINTERN Resource *Generic_device_resource(Generic_device const *self,int idx)
     return self->resources()->at(idx);
   }
 SWIGINTERN void Vi_Device_set_name(Vi::Device *self,char const *name){ self->name(name); }
+SWIGINTERN Hw::Device *Hw_Device_children(Hw::Device const *self){
+    Hw::Async_init::complete(self);
+    return self->children();
+  }
 SWIGINTERN Hw::Device *Hw_Device_find_by_name(Hw::Device const *self,std::string const &name){
-    for (Hw::Device::iterator c = self->begin(0);
-         c != self->end(); ++c)
-      if (name == (*c)->name())
-        return *c;
-
-    return 0;
+    Hw::Async_init::complete(self);
+    return self->find_by_name(name);
   }
 SWIGINTERN Hw::Device *Hw_Device___getitem(Hw::Device const *self,std::string const &name){
-    for (Hw::Device::iterator c = self->begin(0);
-         c != self->end(); ++c)
-      if (name == (*c)->name())
-        return *c;
-
-    return 0;
+    Hw::Async_init::complete(self);
+    return self->find_by_name(name);
   }
 SWIGINTERN void Hw_Device___setitem(Hw::Device *self,std::string const &name,Hw::Device *dev){
     dev->set_name(name);
@@ -2989,6 +2985,61 @@ SWIGINTERN void Hw_Device___setitem(Hw::Device *self,std::string const &name,Hw:
     if (self->parent() || self == system_bus())
       dev->plugin();
   }
+
+#include "cid_matcher.h"
+
+#include <new>
+
+static char const *const Io_cid_matcher_meta = "Io.Cid_matcher";
+
+static int Io_cid_matcher_gc(lua_State *L)
+{
+  auto *m = static_cast<Hw::Cid_matcher *>(luaL_checkudata(L, 1, Io_cid_matcher_meta));
+  m->~Cid_matcher();
+  return 0;
+}
+
+/* Io.cid_matcher(cid, ...): compile a list of compatible IDs */
+int Io_cid_matcher(lua_State *L)
+{
+  int n = lua_gettop(L);
+  auto *m = new (lua_newuserdata(L, sizeof(Hw::Cid_matcher))) Hw::Cid_matcher();
+  if (luaL_newmetatable(L, Io_cid_matcher_meta))
+    {
+      lua_pushcfunction(L, Io_cid_matcher_gc);
+      lua_setfield(L, -2, "__gc");
+    }
+  lua_setmetatable(L, -2);
+
+  for (int i = 1; i <= n; ++i)
+    m->add(luaL_checkstring(L, i));
+
+  return 1;
+}
+
+/* Io.match_devices(hw_dev, matcher): list of matching devices below hw_dev */
+int Io_match_devices(lua_State *L)
+{
+  Hw::Device *dev = 0;
+  if (!SWIG_IsOK(SWIG_ConvertPtr(L, 1, (void **)&dev, SWIGTYPE_p_Hw__Device, 0))
+      || !dev)
+    return luaL_argerror(L, 1, "expected a hardware device");
+
+  auto *m = static_cast<Hw::Cid_matcher *>(luaL_checkudata(L, 2, Io_cid_matcher_meta));
+
+  std::vector<Hw::Device *> devs;
+  m->find(dev, &devs);
+
+  lua_createtable(L, devs.size(), 0);
+  for (unsigned i = 0; i < devs.size(); ++i)
+    {
+      SWIG_NewPointerObj(L, devs[i], SWIGTYPE_p_Hw__Device, 0);
+      lua_rawseti(L, -2, i + 1);
+    }
+
+  return 1;
+}
+
 #ifdef __cplusplus
 // removed: extern "C" {
 #endif
@@ -4095,7 +4146,7 @@ static int _wrap_Hw_device_children(lua_State* L) { int SWIG_arg = 0; Hw::Device
   if(!SWIG_isptrtype(L,1)) SWIG_fail_arg("Hw::Device::children",1,"Hw::Device const *");
   if (!SWIG_IsOK(SWIG_ConvertPtr(L,1,(void**)&arg1,SWIGTYPE_p_Hw__Device,0))){
     SWIG_fail_ptr("Hw_device_children",1,SWIGTYPE_p_Hw__Device); } 
-  result = (Hw::Device *)((Hw::Device const *)arg1)->children();
+  result = (Hw::Device *)Hw_Device_children((Hw::Device const *)arg1);
   SWIG_NewPointerObj(L,result,SWIGTYPE_p_Hw__Device,0); SWIG_arg++;  return SWIG_arg; if(0) SWIG_fail; fail: lua_error(L);
   return SWIG_arg; }
 static int _wrap_Hw_device_next(lua_State* L) { int SWIG_arg = 0; Hw::Device *arg1 = (Hw::Device *) 0 ; Hw::Device *result = 0 ;
@@ -4394,6 +4445,8 @@ static swig_lua_method swig_SwigModule_methods[]= {
     { "system_bus", _wrap_system_bus},
     { "dump_devs", _wrap_dump_devs},
     { "add_vbus", _wrap_add_vbus},
+    { "cid_matcher",Io_cid_matcher},
+    { "match_devices",Io_match_devices},
     {0,0}
 };
 static swig_lua_class* swig_SwigModule_classes[]= {
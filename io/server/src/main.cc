@@ -26,15 +26,24 @@
 #include "virt/vbus_factory.h"
 #include "phys_space.h"
 #include "cfg.h"
-
+#include "config_snapshot.h"
+#include "pci-driver.h"
+#include "pci-enum-cache.h"
+#include "pci-tuning.h"
+#include "pool_alloc.h"
+#include "timing_stats.h"
+
+#include <cerrno>
 #include <cstdio>
 #include <typeinfo>
 #include <algorithm>
 #include <string>
+#include <vector>
 #include <getopt.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 
 #include <lua.h>
@@ -95,7 +104,27 @@ public:
   bool expansion_rom(Hw::Device *) const override
   { return false; }
 
+  bool sriov_lazy_vfs(Hw::Device *) const override
+  { return _sriov_lazy_vfs; }
+
+  Pci_alloc pci_alloc() const override
+  { return _pci_alloc; }
+
   void set_transparent_msi(bool v) { _do_transparent_msi = v; }
+  void set_sriov_lazy_vfs(bool v) { _sriov_lazy_vfs = v; }
+  void set_pci_alloc(Pci_alloc m) { _pci_alloc = m; }
+
+  char const *enum_cache() const { return _enum_cache; }
+  void set_enum_cache(char const *cap) { _enum_cache = cap; }
+
+  char const *config_snapshot() const { return _config_snapshot; }
+  void set_config_snapshot(char const *cap) { _config_snapshot = cap; }
+
+  bool drop_lua() const { return _drop_lua; }
+  void set_drop_lua(bool v) { _drop_lua = v; }
+
+  bool startup_report() const { return _startup_report; }
+  void set_startup_report(bool v) { _startup_report = v; }
 
   int verbose() const override { return _verbose_lvl; }
   void inc_verbosity() { ++_verbose_lvl; }
@@ -103,6 +132,12 @@ public:
 private:
   bool _do_transparent_msi;
   int _verbose_lvl;
+  char const *_enum_cache = nullptr;
+  bool _sriov_lazy_vfs = false;
+  Pci_alloc _pci_alloc = Pci_alloc_firmware;
+  char const *_config_snapshot = nullptr;
+  bool _drop_lua = false;
+  bool _startup_report = false;
 };
 
 static Io_config_x _my_cfg __attribute__((init_priority(30000)));
@@ -153,6 +188,38 @@ int add_vbus(Vi::Device *dev);
 
 void dump_devs(Device *d) { dump(d); }
 
+namespace {
+
+/**
+ * Complete the asynchronous initializations no virtual bus waited for.
+ *
+ * Runs from the server loop once it is started, so the virtual buses are
+ * served without waiting for the devices they do not use.
+ */
+struct Deferred_init : L4::Ipc_svr::Timeout
+{
+  void expired() override
+  {
+    l4_uint64_t start = Timing_stats::now_us();
+    std::vector<Hw::Device *> completed;
+    Hw::Async_init::complete_all(&completed);
+    pci_wait_async_probes();
+
+    // the devices themselves were checked before, only their children are new
+    for (Hw::Device *d: completed)
+      for (auto i = d->begin(100); i != d->end(); ++i)
+        (*i)->check_conflicts();
+
+    pci_enum_cache_store();
+    Timing_stats::record(L4VBUS_TIMING_STARTUP, "deferred async init",
+                         Timing_stats::now_us() - start, L4VBUS_STARTUP_PHASE);
+  }
+};
+
+Deferred_init deferred_init;
+
+}
+
 
 Hw_icu::Hw_icu()
 {
@@ -170,8 +237,16 @@ int add_vbus(Vi::Device *dev)
       return -1;
     }
 
+  Config_snapshot::get()->add_vbus(b);
+
+  // the devices must be completely probed before their resources are set up
+  pci_wait_async_probes();
+
+  l4_uint64_t start = Timing_stats::now_us();
   b->request_child_resources();
   b->allocate_pending_child_resources();
+  Timing_stats::record_startup_step(L4VBUS_STARTUP_ALLOC, start,
+                                    [b]{ return std::string(b->name()); });
   b->finalize();
 
   if (!registry->register_obj(b, b->name()).is_valid())
@@ -228,6 +303,28 @@ read_config(char const *cfg_file, lua_State *lua)
 
 
 
+/**
+ * Parse the thread count of a `--*-workers` option.
+ *
+ * \retval true   `*workers` holds the parsed value.
+ * \retval false  `arg` is not a number between 0 and 1024.
+ */
+static bool
+parse_workers(char const *opt, char const *arg, unsigned *workers)
+{
+  char *end;
+  errno = 0;
+  long v = strtol(arg, &end, 0);
+  if (end == arg || *end || errno || v < 0 || v > 1024)
+    {
+      printf("Invalid thread count '%s' for --%s, option ignored\n", arg, opt);
+      return false;
+    }
+
+  *workers = v;
+  return true;
+}
+
 static int
 arg_init(int argc, char * const *argv, Io_config_x *cfg)
 {
@@ -240,6 +337,15 @@ arg_init(int argc, char * const *argv, Io_config_x *cfg)
         OPT_TRANSPARENT_MSI   = 1,
         OPT_TRACE             = 2,
         OPT_ACPI_DEBUG        = 3,
+        OPT_ENUM_CACHE        = 4,
+        OPT_PM_WORKERS        = 5,
+        OPT_SRIOV_LAZY_VFS    = 6,
+        OPT_PCI_ALLOC         = 7,
+        OPT_CONFIG_SNAPSHOT   = 8,
+        OPT_DROP_LUA          = 9,
+        OPT_ACPI_LAZY         = 10,
+        OPT_INIT_WORKERS      = 11,
+        OPT_STARTUP_REPORT    = 12,
       };
 
       struct option opts[] =
@@ -248,6 +354,15 @@ arg_init(int argc, char * const *argv, Io_config_x *cfg)
         { "transparent-msi",   0, 0, OPT_TRANSPARENT_MSI },
         { "trace",             1, 0, OPT_TRACE },
         { "acpi-debug-level",  1, 0, OPT_ACPI_DEBUG },
+        { "enum-cache",        1, 0, OPT_ENUM_CACHE },
+        { "pm-workers",        1, 0, OPT_PM_WORKERS },
+        { "sriov-lazy-vfs",    0, 0, OPT_SRIOV_LAZY_VFS },
+        { "pci-alloc",         1, 0, OPT_PCI_ALLOC },
+        { "config-snapshot",   1, 0, OPT_CONFIG_SNAPSHOT },
+        { "drop-lua",          0, 0, OPT_DROP_LUA },
+        { "acpi-lazy",         0, 0, OPT_ACPI_LAZY },
+        { "init-workers",      1, 0, OPT_INIT_WORKERS },
+        { "startup-report",    0, 0, OPT_STARTUP_REPORT },
         { 0, 0, 0, 0 },
       };
 
@@ -278,6 +393,63 @@ arg_init(int argc, char * const *argv, Io_config_x *cfg)
             printf("Set acpi debug level to 0x%08x\n", acpi_debug_level);
             break;
           }
+        case OPT_ENUM_CACHE:
+          printf("Using PCI enumeration cache '%s'\n", optarg);
+          cfg->set_enum_cache(optarg);
+          break;
+        case OPT_PM_WORKERS:
+          {
+            unsigned workers;
+            if (!parse_workers("pm-workers", optarg, &workers))
+              break;
+            Pm::pm_set_workers(workers);
+            printf("Using %u threads for suspend/resume\n",
+                   workers ? workers : 1);
+            break;
+          }
+        case OPT_SRIOV_LAZY_VFS:
+          printf("Creating SR-IOV VFs on demand\n");
+          cfg->set_sriov_lazy_vfs(true);
+          break;
+        case OPT_PCI_ALLOC:
+          if (!strcmp(optarg, "firmware"))
+            cfg->set_pci_alloc(Io_config::Pci_alloc_firmware);
+          else if (!strcmp(optarg, "global"))
+            cfg->set_pci_alloc(Io_config::Pci_alloc_global);
+          else if (!strcmp(optarg, "dry-run"))
+            cfg->set_pci_alloc(Io_config::Pci_alloc_dry_run);
+          else
+            {
+              printf("Unknown PCI allocation mode '%s'\n", optarg);
+              break;
+            }
+          printf("Using PCI allocation mode '%s'\n", optarg);
+          break;
+        case OPT_CONFIG_SNAPSHOT:
+          printf("Using configuration snapshot '%s'\n", optarg);
+          cfg->set_config_snapshot(optarg);
+          break;
+        case OPT_DROP_LUA:
+          printf("Releasing the Lua state after configuration\n");
+          cfg->set_drop_lua(true);
+          break;
+        case OPT_ACPI_LAZY:
+          printf("Probing ACPI devices on first use\n");
+          acpi_set_lazy(true);
+          break;
+        case OPT_INIT_WORKERS:
+          {
+            unsigned workers;
+            if (!parse_workers("init-workers", optarg, &workers))
+              break;
+            Hw::Async_init::set_workers(workers);
+            printf("Using %u threads for asynchronous device initialization\n",
+                   workers);
+            break;
+          }
+        case OPT_STARTUP_REPORT:
+          cfg->set_startup_report(true);
+          break;
         }
     }
   return optind;
@@ -420,6 +592,16 @@ static
 int
 run(int argc, char * const *argv)
 {
+  l4_uint64_t const startup = Timing_stats::now_us();
+  l4_uint64_t phase_start = startup;
+  auto phase_done = [&phase_start](char const *name)
+    {
+      l4_uint64_t t = Timing_stats::now_us();
+      Timing_stats::record(L4VBUS_TIMING_STARTUP, name, t - phase_start,
+                           L4VBUS_STARTUP_PHASE);
+      phase_start = t;
+    };
+
   int argfileidx = arg_init(argc, argv, &_my_cfg);
 
   printf("Io service\n");
@@ -428,6 +610,7 @@ run(int argc, char * const *argv)
   d_printf(DBG_INFO, "Verboseness level: %d\n", Io_config::cfg->verbose());
 
   res_init();
+  phase_done("res_init");
 
   if (dlevel(DBG_DEBUG))
     Phys_space::space.dump();
@@ -445,6 +628,7 @@ run(int argc, char * const *argv)
       system_bus()->set_dma_domain_factory(new Iommu_dma_domain_factory());
       Iommu_dma_domain::init();
     }
+  phase_done("iommu init");
 
 #if defined(ARCH_x86) || defined(ARCH_amd64)
   hw_system_bus()->set_can_alloc_cb([](Resource const *r)
@@ -461,51 +645,82 @@ run(int argc, char * const *argv)
 #endif
 
   acpica_init();
+  phase_done("acpica_init");
+
+  if (_my_cfg.enum_cache())
+    pci_enum_cache_init(_my_cfg.enum_cache());
+
+  pci_tuning_init(system_bus());
 
   system_bus()->plugin();
+  phase_done("discovery and driver init");
 
-  lua_State *lua = luaL_newstate();
+  lua_State *lua = nullptr;
+  Config_snapshot *snap = Config_snapshot::get();
+  char const *const *files = argv + argfileidx;
+  unsigned num_files = argc - argfileidx;
 
-  if (!lua)
+  if (_my_cfg.config_snapshot()
+      && snap->init(_my_cfg.config_snapshot(), files, num_files) == 0
+      && snap->load() == 0)
+    d_printf(DBG_INFO, "Configured from snapshot, Lua not started\n");
+  else
     {
-      printf("ERROR: cannot allocate Lua state\n");
-      exit(1);
-    }
+      lua = luaL_newstate();
 
-  lua_newtable(lua);
-  lua_setglobal(lua, "Io");
+      if (!lua)
+        {
+          printf("ERROR: cannot allocate Lua state\n");
+          exit(1);
+        }
 
-  for (int i = 0; libs[i].func; ++i)
-    {
-      luaL_requiref(lua, libs[i].name, libs[i].func, 1);
-      lua_pop(lua, 1);
-    }
+      lua_newtable(lua);
+      lua_setglobal(lua, "Io");
 
-  luaopen_Io(lua);
+      for (int i = 0; libs[i].func; ++i)
+        {
+          luaL_requiref(lua, libs[i].name, libs[i].func, 1);
+          lua_pop(lua, 1);
+        }
 
-  extern char const _binary_io_lua_start[];
-  extern char const _binary_io_lua_end[];
+      luaopen_Io(lua);
 
-  if (luaL_loadbuffer(lua, _binary_io_lua_start,
-                      _binary_io_lua_end - _binary_io_lua_start,
-                      "@io.lua"))
-    {
-      d_printf(DBG_ERR, "INTERNAL: lua error: %s.\n", lua_tostring(lua, -1));
-      lua_pop(lua, lua_gettop(lua));
-      return 1;
-    }
+      extern char const _binary_io_lua_start[];
+      extern char const _binary_io_lua_end[];
 
-  if (lua_pcall(lua, 0, 1, 0))
-    {
-      d_printf(DBG_ERR, "INTERNAL: lua error: %s.\n", lua_tostring(lua, -1));
-      lua_pop(lua, lua_gettop(lua));
-      return 1;
+      if (luaL_loadbuffer(lua, _binary_io_lua_start,
+                          _binary_io_lua_end - _binary_io_lua_start,
+                          "@io.lua"))
+        {
+          d_printf(DBG_ERR, "INTERNAL: lua error: %s.\n",
+                   lua_tostring(lua, -1));
+          lua_pop(lua, lua_gettop(lua));
+          return 1;
+        }
+
+      if (lua_pcall(lua, 0, 1, 0))
+        {
+          d_printf(DBG_ERR, "INTERNAL: lua error: %s.\n",
+                   lua_tostring(lua, -1));
+          lua_pop(lua, lua_gettop(lua));
+          return 1;
+        }
+
+      for (; argfileidx < argc; ++argfileidx)
+        read_config(argv[argfileidx], lua);
     }
+  phase_done(lua ? "lua config" : "config snapshot");
+
+  // the virtual buses completed the devices they reference, the others are
+  // completed once the server loop runs, see Deferred_init
+  pci_wait_async_probes();
 
-  for (; argfileidx < argc; ++argfileidx)
-    read_config(argv[argfileidx], lua);
+  if (lua)
+    snap->store();
+  phase_done("async init");
 
   acpi_late_setup();
+  phase_done("acpi_late_setup");
 
   if (dlevel(DBG_DEBUG))
     {
@@ -514,12 +729,32 @@ run(int argc, char * const *argv)
     }
 
   check_conflicts(system_bus());
+  phase_done("check_conflicts");
+
+  if (lua && _my_cfg.drop_lua())
+    {
+      // the configuration is complete, nothing calls into Lua anymore
+      lua_close(lua);
+      lua = nullptr;
+      d_printf(DBG_INFO, "Released the Lua state\n");
+    }
 
   if (!registry->register_obj(platform_control(), "platform_ctl"))
     d_printf(DBG_WARN, "warning: could not register control interface at"
                        " cap 'platform_ctl'\n");
 
+  Timing_stats::record(L4VBUS_TIMING_STARTUP, "total",
+                       Timing_stats::now_us() - startup, L4VBUS_STARTUP_PHASE);
+
+  if (_my_cfg.startup_report() || dlevel(DBG_INFO))
+    {
+      printf("Start-up times, longest first:\n");
+      Timing_stats::print_sorted(L4VBUS_TIMING_STARTUP, 30);
+      Pool_alloc::print_stats(dlevel(DBG_DEBUG));
+    }
+
   fprintf(stderr, "Ready. Waiting for requests.\n");
+  server_add_timeout(&deferred_init, l4_kip_clock(l4re_kip()));
   server_loop();
 
   return 0;
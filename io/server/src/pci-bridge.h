@@ -206,4 +206,11 @@ public:
   Dma_requester_id dma_alias() const override;
 };
 
+/**
+ * Print the bridge window layout the global PCI allocation would produce for
+ * the hierarchy below the root bridge device `root`, next to the windows
+ * programmed by the firmware.
+ */
+void report_global_alloc(Hw::Device *root);
+
 } }
@@ -38,14 +38,54 @@ struct Capability
 
 struct Pcie_cap : Capability
 {
+  struct Flags : R<0x02, l4_uint16_t>
+  {
+    CXX_BITFIELD_MEMBER( 0,  3, version, v);
+    CXX_BITFIELD_MEMBER( 4,  7, type, v);
+  };
+
+  struct Dev_caps : R<0x04, l4_uint32_t>
+  {
+    CXX_BITFIELD_MEMBER( 0,  2, max_payload_size_supported, v);
+    CXX_BITFIELD_MEMBER( 5,  5, ext_tag_supported, v);
+    CXX_BITFIELD_MEMBER( 6,  8, l0s_acceptable_latency, v);
+    CXX_BITFIELD_MEMBER( 9, 11, l1_acceptable_latency, v);
+  };
+
+  struct Dev_ctrl : R<0x08, l4_uint16_t>
+  {
+    CXX_BITFIELD_MEMBER( 4,  4, relaxed_ordering, v);
+    CXX_BITFIELD_MEMBER( 5,  7, max_payload_size, v);
+    CXX_BITFIELD_MEMBER( 8,  8, ext_tag, v);
+    CXX_BITFIELD_MEMBER(11, 11, no_snoop, v);
+    CXX_BITFIELD_MEMBER(12, 14, max_read_request_size, v);
+  };
+
+  struct Link_caps : R<0x0c, l4_uint32_t>
+  {
+    CXX_BITFIELD_MEMBER(10, 11, aspm_support, v);
+    CXX_BITFIELD_MEMBER(12, 14, l0s_exit_latency, v);
+    CXX_BITFIELD_MEMBER(15, 17, l1_exit_latency, v);
+  };
+
+  struct Link_ctrl : R<0x10, l4_uint16_t>
+  {
+    CXX_BITFIELD_MEMBER( 0,  1, aspm_ctrl, v);
+  };
+
   struct Dev_caps2 : R<0x24, l4_uint32_t>
   {
     CXX_BITFIELD_MEMBER( 5,  5, ari_forwarding_supported, v);
+    CXX_BITFIELD_MEMBER(11, 11, ltr_supported, v);
+    CXX_BITFIELD_MEMBER(16, 16, tag10_completer_supported, v);
+    CXX_BITFIELD_MEMBER(17, 17, tag10_requester_supported, v);
   };
 
   struct Dev_ctrl2 : R<0x28, l4_uint16_t>
   {
     CXX_BITFIELD_MEMBER( 5,  5, ari_forwarding_enable, v);
+    CXX_BITFIELD_MEMBER(10, 10, ltr_enable, v);
+    CXX_BITFIELD_MEMBER(12, 12, tag10_requester_enable, v);
   };
 };
 
@@ -179,9 +219,51 @@ struct Acs_cap : Capability
   };
 };
 
+struct L1ss_cap : Capability
+{
+  enum
+  {
+    Id = 0x1e,
+  };
+
+  struct Caps : R<0x04, l4_uint32_t>
+  {
+    CXX_BITFIELD_MEMBER( 0,  0, pcipm_l1_2, v);
+    CXX_BITFIELD_MEMBER( 1,  1, pcipm_l1_1, v);
+    CXX_BITFIELD_MEMBER( 2,  2, aspm_l1_2, v);
+    CXX_BITFIELD_MEMBER( 3,  3, aspm_l1_1, v);
+    CXX_BITFIELD_MEMBER( 4,  4, l1ss_supported, v);
+    CXX_BITFIELD_MEMBER( 8, 15, common_mode_restore_time, v);
+    CXX_BITFIELD_MEMBER(16, 17, t_power_on_scale, v);
+    CXX_BITFIELD_MEMBER(19, 23, t_power_on_value, v);
+  };
+
+  struct Ctrl1 : R<0x08, l4_uint32_t>
+  {
+    CXX_BITFIELD_MEMBER( 0,  0, pcipm_l1_2, v);
+    CXX_BITFIELD_MEMBER( 1,  1, pcipm_l1_1, v);
+    CXX_BITFIELD_MEMBER( 2,  2, aspm_l1_2, v);
+    CXX_BITFIELD_MEMBER( 3,  3, aspm_l1_1, v);
+    CXX_BITFIELD_MEMBER( 8, 15, common_mode_restore_time, v);
+    CXX_BITFIELD_MEMBER(16, 25, ltr_l1_2_threshold_value, v);
+    CXX_BITFIELD_MEMBER(29, 31, ltr_l1_2_threshold_scale, v);
+  };
+
+  struct Ctrl2 : R<0x0c, l4_uint32_t>
+  {
+    CXX_BITFIELD_MEMBER( 0,  1, t_power_on_scale, v);
+    CXX_BITFIELD_MEMBER( 3,  7, t_power_on_value, v);
+  };
+};
+
 struct Resizable_bar_cap : Capability
 {
-  enum { Id = 0x15 };
+  enum
+  {
+    Id = 0x15,
+    Bar_cap_0  = 4, ///< Offset of the first BAR capability register
+    Entry_size = 8, ///< Size of the capability / control register pair
+  };
 
   struct Bar_cap
   {
@@ -247,6 +329,27 @@ struct Resizable_bar_cap : Capability
   {
     enum { Ofs = 8 /**< Offset of the register in bytes */ };
   };
+
+  /// Offset of the BAR capability register of entry `i`.
+  static unsigned bar_cap_ofs(unsigned i)
+  { return Bar_cap_0 + i * Entry_size; }
+
+  /// Offset of the BAR control register of entry `i`.
+  static unsigned bar_ctrl_ofs(unsigned i)
+  { return Bar_ctrl_0::Ofs + i * Entry_size; }
+
+  /**
+   * Get the BAR sizes supported by an entry.
+   *
+   * \return Bitmap of the supported sizes, bit n set means `1 MiB << n` is
+   *         supported, which is the encoding used by Bar_ctrl::size.
+   */
+  static l4_uint64_t supported_sizes(Bar_cap cap, Bar_ctrl ctrl)
+  { return (cap.v >> 4) | (l4_uint64_t{ctrl.v >> 16} << 28); }
+
+  /// Convert a size encoding of Bar_ctrl::size to bytes.
+  static l4_uint64_t size_bytes(unsigned enc)
+  { return l4_uint64_t{1} << (enc + 20); }
 };
 
 } }
@@ -184,6 +184,26 @@ class Config_space
 public:
   virtual int cfg_read(Cfg_addr addr, l4_uint32_t *value, Cfg_width) = 0;
   virtual int cfg_write(Cfg_addr addr, l4_uint32_t value, Cfg_width) = 0;
+
+  /**
+   * Start a batch of accesses to the function at `addr`.
+   *
+   * Config spaces with an expensive per-access setup may keep that setup
+   * programmed for the function until cfg_batch_end() and defer their error
+   * checks to the end of the batch. Hence accesses within a batch shall only
+   * target functions known to exist. Accesses to other functions are
+   * allowed, but may not benefit from the batch. Batches may be nested.
+   */
+  virtual void cfg_batch_begin(Cfg_addr) {}
+
+  /**
+   * End a batch of accesses started with cfg_batch_begin().
+   *
+   * \retval 0     All accesses of the batch succeeded.
+   * \retval -EIO  An error was detected for an access within the batch.
+   */
+  virtual int cfg_batch_end() { return 0; }
+
   virtual ~Config_space() = 0;
 };
 
@@ -289,11 +309,72 @@ public:
   Cfg_addr addr() const { return _addr; }
   unsigned reg() const { return _addr.reg(); }
 
+  /**
+   * Read a block of consecutive 32-bit registers within one batch.
+   *
+   * \param      reg     Offset of the first register, must be 32-bit aligned.
+   * \param[out] buf     Buffer receiving the register values.
+   * \param      dwords  Number of registers to read.
+   */
+  int read_block(unsigned reg, l4_uint32_t *buf, unsigned dwords) const;
+
 private:
   Config_space *_cfg = nullptr;
   Cfg_addr _addr;
 };
 
+/**
+ * Scope guard for a batch of config space accesses to one function.
+ *
+ * \see Config_space::cfg_batch_begin()
+ */
+class Cfg_batch
+{
+public:
+  explicit Cfg_batch(Config const &c) : _cfg(c.cfg_spc())
+  {
+    if (_cfg)
+      _cfg->cfg_batch_begin(c.addr());
+  }
+
+  ~Cfg_batch() { end(); }
+
+  /**
+   * End the batch before the end of the scope.
+   *
+   * \return The result of Config_space::cfg_batch_end().
+   */
+  int end()
+  {
+    if (!_cfg)
+      return 0;
+
+    int r = _cfg->cfg_batch_end();
+    _cfg = nullptr;
+    return r;
+  }
+
+  Cfg_batch(Cfg_batch const &) = delete;
+  Cfg_batch &operator = (Cfg_batch const &) = delete;
+
+private:
+  Config_space *_cfg;
+};
+
+inline int
+Config::read_block(unsigned reg, l4_uint32_t *buf, unsigned dwords) const
+{
+  Cfg_batch batch(*this);
+  for (unsigned i = 0; i < dwords; ++i)
+    {
+      int r = read(reg + i * 4, &buf[i], Cfg_long);
+      if (r < 0)
+        return r;
+    }
+
+  return batch.end();
+}
+
 
 /**
  * Generic PCI capability structure.
@@ -400,6 +481,45 @@ public:
     return true;
   }
 
+  /**
+   * Parse a PCI BAR register of already known type and size.
+   *
+   * Only the current base address is read from the BAR, no sizing is done.
+   * So this does not need disabled decoders.
+   *
+   * \retval false  The BAR register does not match the given type.
+   */
+  bool parse_known(Type type, bool is_64bit, bool prefetchable,
+                   l4_uint64_t size)
+  {
+    auto v = read<l4_uint32_t>(0);
+    if ((v & 1) != (type == T_io ? 1U : 0U))
+      return false;
+
+    _type = type;
+    _size = size;
+
+    if (type == T_io)
+      {
+        _base = v & ~(l4_uint32_t)3;
+        _flags = 0;
+        return true;
+      }
+
+    if (((v & 0x7) == 0x4) != is_64bit)
+      return false;
+
+    _base = (v & ~(l4_uint32_t)0xf);
+    _flags = prefetchable ? 8 : 0;
+    if (is_64bit)
+      {
+        _base |= static_cast<l4_uint64_t>(read<l4_uint32_t>(4)) << 32;
+        _flags |= 1;
+      }
+
+    return true;
+  }
+
   Type type() const { return static_cast<Type>(_type); }
   bool is_64bit() const { return _flags & 1; }
   bool is_prefetchable() const { return _flags & 8; }
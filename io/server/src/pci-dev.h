@@ -10,6 +10,7 @@
 #include <pci-if.h>
 #include <pci-cfg.h>
 #include <pci-saved-config.h>
+#include <pci-enum-cache.h>
 
 #include <cassert>
 
@@ -67,9 +68,48 @@ public:
   void fill(l4_uint32_t vendor_device, Config const &c);
 
 private:
+  void _read_header(Config const &c);
   void _discover_pci_caps(Config const &c);
 };
 
+class Dev;
+
+/**
+ * A PCI compatible ID, e.g. "PCI/CC_0200&VEN_8086&DEV_1572", parsed into
+ * mask/value pairs for the IDs in the configuration header.
+ *
+ * All tokens of the ID must match: `CC_` with 2, 4 or 6 hex digits of the
+ * class code, `REV_`, `VEN_`, `DEV_`, `SUBSYS_` and
+ * `ADR_<segment>:<bus>:<device>.<function>`.
+ */
+struct Cid
+{
+  l4_uint32_t vd_mask = 0;  ///< mask for the vendor/device ID register
+  l4_uint32_t vd_val = 0;
+  l4_uint32_t cc_mask = 0;  ///< mask for the class code/revision register
+  l4_uint32_t cc_val = 0;
+  l4_uint32_t ss_mask = 0;  ///< mask for the subsystem ID register
+  l4_uint32_t ss_val = 0;
+
+  bool has_adr = false;     ///< match the address below
+  unsigned segment = 0;
+  unsigned bus = 0;
+  unsigned devfn = 0;
+
+  /**
+   * Parse a compatible ID.
+   *
+   * \retval true   `cid` is a valid PCI compatible ID.
+   * \retval false  `cid` is no PCI ID or malformed, it matches no function.
+   */
+  bool parse(cxx::String cid);
+
+  bool match(Dev const *d) const;
+
+private:
+  bool add(l4_uint32_t *mask, l4_uint32_t *val, l4_uint32_t m, l4_uint32_t v);
+};
+
 class Dev :
   public virtual If,
   private Io_irq_pin::Msi_src
@@ -151,9 +191,19 @@ private:
 
   Transparent_msi *_transp_msi = 0;
 
+  l4_uint16_t _msi_cap = 0;      ///< offset of the MSI cap
+  l4_uint16_t _msix_cap = 0;     ///< offset of the MSI-X cap
+  l4_uint8_t _irq_mode = 0;      ///< current Irq_mode
+  Resource *_msi_res = nullptr;  ///< transparent MSI, created on demand
+  Resource *_msix_res = nullptr; ///< transparent MSI-X, created on demand
+
+  l4_uint16_t _rebar_cap = 0; ///< offset of the resizable BAR cap
+  l4_uint8_t _rebar_bars = 0; ///< BARs controlled by the resizable BAR cap
+
   Saved_config _saved_state;
 
-  void parse_msi_cap(Cfg_addr cap_ptr);
+  void setup_irq_mode();
+  Resource *create_msi_res(bool msix);
 
   using Ext_cap_handler = bool(*)(Dev *dev, Extended_cap cap);
   void handle_ext_cap(unsigned char id, Ext_cap_handler handler);
@@ -162,6 +212,9 @@ private:
   static bool handle_sriov_cap(Dev *dev, Extended_cap cap);
   static bool handle_acs_cap(Dev *dev, Extended_cap cap);
 
+  void discover_rebar();
+  Resource *new_rebar_resource(unsigned bar, unsigned long flags);
+
 public:
   enum Cfg_status
   {
@@ -275,6 +328,60 @@ public:
 
   bool check_pme_status();
 
+  /**
+   * Change the size of resizable BARs after their allocation.
+   *
+   * \param bar   The BAR to resize, -1 for all resizable BARs.
+   * \param size  Desired size in bytes, rounded down to a size supported by
+   *              the device.
+   *
+   * \retval -L4_ENOSPC  The desired size exceeds the allocated BAR.
+   * \retval -L4_EBUSY   The device is already assigned to a vbus.
+   */
+  int set_rebar_size(int bar, l4_uint64_t size);
+
+  /**
+   * Set the size of a resizable BAR before its allocation.
+   *
+   * \param bar    The BAR to size.
+   * \param res    The resource of the BAR.
+   * \param limit  Largest size wanted, 0 to keep the current size. The
+   *               smallest supported size is used if none fits.
+   *
+   * \retval true   The size of the BAR changed.
+   * \retval false  The BAR keeps its size.
+   */
+  bool resize_rebar(unsigned bar, Resource *res, l4_uint64_t limit);
+
+  /**
+   * How the interrupt of the device is delivered to clients.
+   *
+   * With MSI and MSI-X, IO programs the device to signal a single message
+   * and provides it to clients as an ordinary interrupt (transparent MSI).
+   */
+  enum Irq_mode
+  {
+    Irq_intx, ///< legacy INTx pin
+    Irq_msi,  ///< transparent MSI
+    Irq_msix, ///< transparent MSI-X using the first table entry
+    Irq_auto, ///< MSI-X for multi-queue devices, otherwise MSI, or INTx
+  };
+
+  Irq_mode irq_mode() const { return Irq_mode(_irq_mode); }
+
+  /**
+   * Select the interrupt delivery of the device.
+   *
+   * \param mode  The mode to use. Irq_auto selects MSI-X if the device has
+   *              more than one MSI-X vector, MSI if the device supports it,
+   *              then MSI-X and INTx otherwise.
+   *
+   * \retval -L4_ENODEV  The device lacks the capability for the mode.
+   * \retval -L4_ENOSYS  The system ICU does not support MSIs.
+   * \retval -L4_EBUSY   The device is already assigned to a vbus.
+   */
+  int set_irq_mode(Irq_mode mode);
+
   void pm_save_state(Hw::Device *) override;
   void pm_restore_state(Hw::Device *) override;
 
@@ -286,10 +393,24 @@ protected:
   void discover_pcie_caps();
 
 private:
-  int discover_bar(int bar);
-  void discover_expansion_rom();
+  int discover_bar(int bar, Enum_cache::Entry const *cached);
+  void discover_expansion_rom(Enum_cache::Entry const *cached);
 };
 
+/**
+ * Add a PCI function to the global segment/bus/devfn index.
+ *
+ * Must be called for each Dev once its host device is set up, i.e. after it
+ * is known at which bus and devfn it is located.
+ */
+void register_pci_device(Dev *dev);
+
+/**
+ * Find a PCI function by its address.
+ *
+ * \return The PCI function registered for the given address, nullptr if
+ *         there is none.
+ */
 Dev *
 find_pci_device(l4_uint16_t seg, l4_uint8_t bus, l4_uint8_t devnr,
                 l4_uint8_t fn);
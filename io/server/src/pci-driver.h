@@ -7,6 +7,8 @@
  */
 #pragma once
 
+#ifdef CONFIG_L4IO_PCI
+
 #include <pci-dev.h>
 
 namespace Hw { namespace Pci {
@@ -15,13 +17,51 @@ class Driver
 {
 public:
   virtual int probe(Dev *) = 0;
+
+  /// Name of the driver, used for the probe timing records.
+  virtual char const *name() const = 0;
+
+  /**
+   * Whether probe() may run on a worker thread.
+   *
+   * Asynchronous probes run concurrently to the discovery of other devices
+   * and to each other, each one after the probe of the nearest parent device
+   * with a driver. They must only access the device itself and must neither
+   * change the device tree nor the resources. All of them are complete
+   * before the resources of a virtual bus are set up, see
+   * wait_async_probes().
+   */
+  virtual bool async_probe() const { return false; }
+
   virtual ~Driver() = 0;
 
   bool register_driver_for_class(l4_uint32_t device_class);
   bool register_driver(l4_uint16_t vendor, l4_uint16_t device);
   static Driver* find(Dev *);
+
+  /**
+   * Probe `dev` with the driver found for it, if any.
+   *
+   * Asynchronous probes are queued on the Worker_pool, using the threads
+   * for the asynchronous device initialization (see
+   * Hw::Async_init::set_workers()). Without such threads they run right
+   * away.
+   */
+  static void probe_dev(Dev *dev);
+
+  /// Wait for all asynchronous probes queued so far.
+  static void wait_async_probes();
 };
 
 inline Driver::~Driver() = default;
 
 } }
+
+inline void pci_wait_async_probes()
+{ Hw::Pci::Driver::wait_async_probes(); }
+
+#else
+
+static inline void pci_wait_async_probes() {}
+
+#endif
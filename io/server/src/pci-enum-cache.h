@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <l4/sys/l4int.h>
+#include <l4/sys/err.h>
+
+#ifdef CONFIG_L4IO_PCI
+
+#include <map>
+
+namespace Hw { namespace Pci {
+
+class Config_cache;
+
+/**
+ * Persistent PCI enumeration cache.
+ *
+ * The enumeration cache stores the BAR and expansion ROM geometry of all
+ * PCI functions found during the previous start of io, together with the
+ * addresses finally assigned to them. The cache is kept in a dataspace
+ * passed to io (`--enum-cache=<cap>`).
+ *
+ * On start-up every discovered function is looked up by its
+ * segment/bus/devfn and validated against its vendor/device, class and
+ * header type. On a match the BAR sizing cycles (which need the decoders of
+ * the device to be disabled) are skipped, and BARs left unassigned by the
+ * firmware are preset with the address they got during the last run, which
+ * lets the request phase place them without a new allocation. Any mismatch
+ * falls back to the full discovery for that function and marks the cache
+ * stale, so that it is rewritten once io is ready.
+ */
+class Enum_cache
+{
+public:
+  enum
+  {
+    Magic   = 0x43454f69, // 'ioEC'
+    Version = 1,
+  };
+
+  enum Bar_flags : l4_uint8_t
+  {
+    Bf_valid    = 0x1,
+    Bf_io       = 0x2,
+    Bf_64bit    = 0x4,
+    Bf_prefetch = 0x8,
+  };
+
+  struct Bar
+  {
+    l4_uint64_t start;
+    l4_uint64_t size;
+    l4_uint8_t  flags;
+    l4_uint8_t  _pad[7];
+  };
+
+  struct Entry
+  {
+    l4_uint32_t bdf;        ///< segment << 16 | bus << 8 | devfn
+    l4_uint32_t vendor_device;
+    l4_uint32_t cls_rev;
+    l4_uint8_t  hdr_type;
+    l4_uint8_t  _pad[3];
+    Bar bars[6];
+    Bar rom;
+  };
+
+  struct Header
+  {
+    l4_uint32_t magic;
+    l4_uint32_t version;
+    l4_uint32_t num_entries;
+    l4_uint32_t checksum;
+  };
+
+  static Enum_cache *get();
+
+  /**
+   * Load the cache from the dataspace with the given capability name.
+   *
+   * \retval 0   The cache was loaded and can be used.
+   * \retval <0  No usable cache, full enumeration is done.
+   */
+  int init(char const *cap_name);
+
+  /**
+   * Lookup the cache entry for a PCI function.
+   *
+   * \return The cache entry if it exists and matches the IDs in `cc`,
+   *         nullptr otherwise.
+   */
+  Entry const *lookup(unsigned segment, Config_cache const &cc);
+
+  /**
+   * Write the current PCI topology back to the cache dataspace if the
+   * loaded contents do not match the discovered hardware.
+   */
+  void store();
+
+  bool enabled() const { return _buf != nullptr; }
+
+  static l4_uint32_t bdf(unsigned segment, unsigned bus, unsigned devfn)
+  { return (segment << 16) | ((bus & 0xff) << 8) | (devfn & 0xff); }
+
+private:
+  typedef std::map<l4_uint32_t, Entry> Entry_map;
+
+  static l4_uint32_t checksum(Entry const *e, unsigned num);
+
+  Entry_map _entries;
+  char *_buf = nullptr;
+  l4_size_t _size = 0;
+  bool _writable = false;
+  bool _stale = false;
+  unsigned _hits = 0;
+};
+
+} }
+
+inline int pci_enum_cache_init(char const *cap_name)
+{ return Hw::Pci::Enum_cache::get()->init(cap_name); }
+
+inline void pci_enum_cache_store()
+{ Hw::Pci::Enum_cache::get()->store(); }
+
+#else
+
+static inline int pci_enum_cache_init(char const *) { return -L4_ENOSYS; }
+static inline void pci_enum_cache_store() {}
+
+#endif
@@ -9,6 +9,8 @@
 
 #include <pci-bridge.h>
 
+#include <l4/cxx/minmax>
+
 #include <pthread.h>
 
 namespace Hw { namespace Pci {
@@ -77,6 +79,9 @@ public:
     return ++subordinate;
   }
 
+  /// Highest bus number the config space access of the bridge can reach.
+  virtual unsigned last_bus() const { return 0xff; }
+
   unsigned segment() const override
   { return _segment; }
 };
@@ -94,25 +99,56 @@ private:
   pthread_mutex_t _cfg_lock = PTHREAD_MUTEX_INITIALIZER;
 };
 
+/**
+ * Root bridge using the PCIe enhanced configuration access mechanism (ECAM).
+ *
+ * The ECAM window of each bus is mapped on the first access to that bus, so
+ * that only the config space of busses that are actually scanned ends up
+ * being mapped.
+ */
 struct Mmio_root_bridge : public Root_bridge
 {
+  enum { Bus_shift = 20 };
+
   explicit Mmio_root_bridge(unsigned segment, unsigned bus_nr,
                             Hw::Device *host,
                             l4_uint64_t phys_base, unsigned num_busses,
                             Platform_adapter_if *platform_adapter)
-  : Root_bridge(segment, bus_nr, host, platform_adapter)
+  : Root_bridge(segment, bus_nr, host, platform_adapter),
+    _phys_base(phys_base), _first_bus(bus_nr), _num_busses(num_busses)
   {
-    _mmio = res_map_iomem(phys_base, num_busses * (1 << 20));
-    if (!_mmio)
-      throw("ne");
+    for (auto &m: _bus_mmio)
+      m = 0;
   }
 
   int cfg_read(Cfg_addr addr, l4_uint32_t *value, Cfg_width) override;
   int cfg_write(Cfg_addr addr, l4_uint32_t value, Cfg_width) override;
 
-  l4_addr_t a(Cfg_addr addr) const { return _mmio + addr.addr(); }
+  unsigned last_bus() const override
+  { return cxx::min(_first_bus + _num_busses - 1, 0xffU); }
+
+  /**
+   * Get the virtual address of a config space register.
+   *
+   * \return The address, or 0 if the bus is outside of the ECAM range or the
+   *         ECAM window could not be mapped.
+   */
+  l4_addr_t a(Cfg_addr addr)
+  {
+    l4_addr_t m = _bus_mmio[addr.bus()];
+    if (L4_UNLIKELY(!m))
+      m = map_bus(addr.bus());
+
+    return m ? m + (addr.addr() & ((1UL << Bus_shift) - 1)) : 0;
+  }
+
+private:
+  l4_addr_t map_bus(unsigned bus);
 
-  l4_addr_t _mmio;
+  l4_uint64_t _phys_base;
+  unsigned _first_bus;
+  unsigned _num_busses;
+  l4_addr_t _bus_mmio[256];
 };
 
 Root_bridge *root_bridge(unsigned segment);
@@ -18,9 +18,14 @@ namespace Hw { namespace Pci {
  *
  * Current limitations:
  *   - SR-IOV is always enabled if the device supports it.
- *   - Allocating multiple bus numbers for a SR-IOV device not supported.
+ *   - Bus numbers for VFs beyond the bus of the PF can only be reserved as long
+ *     as the bus range of the PF's bridge ends at the highest bus number in
+ *     use, i.e. while that bridge is scanned.
  *   - Number of VFs to enable is configured statically according to the Max_vfs
  *     constant (limited by bus capacity and number of VFs the device supports).
+ *     With lazy VFs (Io_config::sriov_lazy_vfs()) VFs are only enabled and
+ *     created once the `num_vfs` property of the PF is set, NumVFs is then set
+ *     to that number.
  *   - Dependencies between PFs not supported.
  */
 class Sr_iov_feature : public Dev_feature
@@ -44,6 +49,16 @@ public:
   /// Enables SR-IOV, runs after discover and resource allocation phase.
   void setup(Hw::Device *host) override;
 
+  /**
+   * Make sure the first `num` VFs exist.
+   *
+   * Enables the VFs on the first call, with NumVFs set to `num` for lazy VFs.
+   *
+   * \retval -L4_ERANGE  More VFs requested than the PF supports.
+   * \retval -L4_EBUSY   The VFs are already enabled with a lower NumVFs.
+   */
+  int create_vfs(unsigned num);
+
   void dump(int indent) const override;
 
 private:
@@ -59,14 +74,29 @@ private:
   /// Discover the number of VFs the device supports and the number we can use.
   bool discover_num_vfs();
 
+  /// Highest bus number that can be made available for VFs.
+  unsigned vf_bus_limit() const;
+
+  /**
+   * Compute how many of the first `num_vfs` VFs have a reachable routing ID,
+   * using the current VF Offset and VF Stride.
+   */
+  l4_uint16_t reachable_vfs(l4_uint16_t num_vfs, char const **reason) const;
+
+  /// Extend the bus range of the PF's bridge up to `last_bus`.
+  bool reserve_vf_buses(unsigned last_bus);
+
   /// Discover size and alignment of the PF's VBAR registers.
   void discover_vbars();
 
   /// Set up the PF's VBAR registers.
   bool setup_vbars();
 
+  /// Set NumVFs and VF Enable, waits until the VFs may be accessed.
+  bool enable_vfs(l4_uint16_t num_vfs);
+
   /// Initialize VF, i.e. create a Hw::Device and request resources.
-  void init_vf(unsigned vf_index, Sr_iov_cap::Vf_device_id vf_dev_id);
+  Hw::Device *init_vf(unsigned vf_index, Sr_iov_cap::Vf_device_id vf_dev_id);
 
 private:
   Dev *_dev;
@@ -77,7 +107,10 @@ private:
   Sr_iov_cap::Num_vfs _num_vfs;
   Sr_iov_cap::Vf_offset _vf_offset;
   Sr_iov_cap::Vf_stride _vf_stride;
+  Sr_iov_cap::Vf_device_id _vf_dev_id;
+  unsigned _num_created = 0;
   bool _ari_capable = false;
+  bool _vbars_ready = false;
   bool _enabled = false;
 };
 
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+namespace Hw {
+  class Device;
+}
+
+#ifdef CONFIG_L4IO_PCI
+
+namespace Hw { namespace Pci {
+
+class Dev;
+
+/**
+ * Hierarchy-wide tuning of PCIe transaction parameters.
+ *
+ * After a PCI hierarchy is discovered below a root bridge, the Max_Payload_Size
+ * (MPS) and Max_Read_Request_Size (MRRS) of its PCIe functions are configured
+ * according to the policy given in the `pcie_bus` property of the system bus,
+ * resembling the `pcie_bus_*` kernel parameters of Linux:
+ *
+ * - "default": Keep the values programmed by the firmware, but lower the MPS
+ *   of functions exceeding the MPS of their upstream port.
+ * - "safe": Use the largest MPS supported by all functions below a root port.
+ * - "performance": Use the largest MPS supported by a function and all
+ *   functions on its path to the root, and limit the MRRS to that MPS.
+ * - "peer2peer": Use an MPS of 128 bytes everywhere.
+ *
+ * Setting the property configures all hierarchies discovered so far again.
+ *
+ * The optional transaction features Relaxed Ordering, No Snoop, Extended Tag
+ * and 10-bit Tag Requester are controlled by the `pcie_features` property,
+ * a comma-separated list of feature names or "none". Each PCIe function has
+ * that property, its value applies to the function and all functions below
+ * it that do not set it themselves. The property of the system bus provides
+ * the default. A feature is only enabled if the function and all functions on
+ * its path to the root support it. Without any policy the firmware settings
+ * are kept.
+ *
+ * Active State Power Management (ASPM) of the links is controlled by the
+ * `pcie_aspm` property, which is inherited the same way:
+ *
+ * - "default": Keep the firmware settings.
+ * - "performance": Disable ASPM and the ASPM L1 PM Substates.
+ * - "powersave": Enable L0s, L1 and the L1 PM Substates if both ends of the
+ *   link support them and the exit latencies are acceptable for all
+ *   endpoints below the link.
+ *
+ * The policy of a link is the one of the functions below it, "performance"
+ * taking precedence over "powersave".
+ */
+class Pcie_tuning
+{
+public:
+  enum Mps_policy
+  {
+    Mps_default,
+    Mps_safe,
+    Mps_performance,
+    Mps_peer2peer,
+  };
+
+  enum Features
+  {
+    F_relaxed_ordering = 1 << 0,
+    F_no_snoop         = 1 << 1,
+    F_ext_tag          = 1 << 2,
+    F_tag10            = 1 << 3,
+  };
+
+  /// Register the policy properties at the system bus.
+  static void init(Hw::Device *system_bus);
+
+  enum Aspm_policy
+  {
+    Aspm_default,
+    Aspm_powersave,
+    Aspm_performance,
+  };
+
+  /// Register the policy properties of a PCIe function.
+  static void add_device(Dev *dev);
+
+  /// Configure the PCIe functions below the root bridge device `root`.
+  static void configure(Hw::Device *root);
+
+  /// Configure all hierarchies passed to configure() before.
+  static void configure_all();
+
+  /**
+   * The PCIe function of a device node, if it takes part in the tuning.
+   *
+   * VFs are skipped, they use the settings and the link of their PF.
+   */
+  static Dev *pcie_fn(Hw::Device *d);
+
+  static Mps_policy mps_policy() { return _mps_policy; }
+  static void mps_policy(Mps_policy p) { _mps_policy = p; }
+
+private:
+  static Mps_policy _mps_policy;
+
+  static void add_aspm_device(Dev *dev);
+  static void add_aspm_property(Hw::Device *dev);
+  static void configure_aspm(Hw::Device *root);
+};
+
+} }
+
+inline void pci_tuning_init(Hw::Device *system_bus)
+{ Hw::Pci::Pcie_tuning::init(system_bus); }
+
+#else
+
+static inline void pci_tuning_init(Hw::Device *) {}
+
+#endif
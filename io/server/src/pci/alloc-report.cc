@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include <pci-bridge.h>
+
+#include "hw_device.h"
+#include "resource_provider.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace Hw { namespace Pci {
+
+namespace {
+
+/**
+ * Shadow copy of a BAR or bridge window.
+ *
+ * The shadow tree is laid out by the same Resource_provider code as the
+ * global allocation, without touching the resources of the devices.
+ */
+struct Item
+{
+  Hw::Device *dev;
+  Resource *orig;
+  Resource *res;
+  bool placed = false;
+  std::vector<Item *> children; ///< resources allocated from this window
+
+  Item(Hw::Device *dev, Resource *orig, Resource *res)
+  : dev(dev), orig(orig), res(res)
+  {}
+};
+
+bool
+is_addr_res(Resource const *r)
+{ return r->type() == Resource::Mmio_res || r->type() == Resource::Io_res; }
+
+class Shadow_tree
+{
+public:
+  std::vector<Item *> windows(Hw::Device *node, bool root);
+  void alloc_children(Hw::Device *node, std::vector<Item *> const &wins,
+                      bool root);
+
+private:
+  std::vector<std::unique_ptr<Resource>> _res;
+  std::deque<Item> _items;
+
+  Item *copy(Hw::Device *dev, Resource *orig, bool root);
+};
+
+/**
+ * Create the shadow of `orig`.
+ *
+ * Root apertures keep their place, bridge windows start out empty as with
+ * the global allocation and BARs keep only their size.
+ */
+Item *
+Shadow_tree::copy(Hw::Device *dev, Resource *orig, bool root)
+{
+  unsigned long flags = orig->flags() & ~Resource::F_disabled;
+  Resource *r;
+  if (!orig->provided())
+    {
+      r = new Resource(flags);
+      r->start_size(orig->fixed_addr() ? orig->start() : 0, orig->size());
+    }
+  else if (root)
+    r = new Resource_provider(flags, orig->start(), orig->end());
+  else
+    {
+      auto *w = new Resource_provider(flags);
+      w->alignment(orig->alignment());
+      if (auto *o = dynamic_cast<Resource_provider *>(orig))
+        w->granularity(o->granularity());
+      w->set_empty();
+      r = w;
+    }
+
+  _res.emplace_back(r);
+  _items.emplace_back(dev, orig, r);
+  return &_items.back();
+}
+
+std::vector<Item *>
+Shadow_tree::windows(Hw::Device *node, bool root)
+{
+  std::vector<Item *> wins;
+  for (Resource *r: *node->resources())
+    if (r && r->provided() && !r->disabled() && is_addr_res(r))
+      wins.push_back(copy(node, r, root));
+  return wins;
+}
+
+/// The window of `wins` a resource is allocated from, like
+/// Device::alloc_child_resource() does.
+Item *
+window_for(std::vector<Item *> const &wins, Resource *r)
+{
+  for (Item *w: wins)
+    if (w->res->compatible(r, true))
+      return w;
+
+  for (Item *w: wins)
+    if (w->res->compatible(r, false))
+      return w;
+
+  return nullptr;
+}
+
+/**
+ * Allocate the BARs and windows of the devices below `node` from the
+ * shadow windows `wins` of `node`.
+ *
+ * Follows Device::allocate_pending_child_resources(): the resources below a
+ * device are allocated first, then the resources of all children of a device
+ * in the order of decreasing alignment and size. Windows of bridges are
+ * sized from their children, the root apertures are allocated from.
+ */
+void
+Shadow_tree::alloc_children(Hw::Device *node, std::vector<Item *> const &wins,
+                            bool root)
+{
+  std::vector<Item *> pending;
+  for (auto c = node->begin(0); c != node->end(); ++c)
+    {
+      std::vector<Item *> cwins = windows(*c, false);
+      alloc_children(*c, cwins, false);
+
+      for (Resource *r: *(*c)->resources())
+        {
+          if (!r || r->disabled() || !is_addr_res(r) || r->relative())
+            continue;
+
+          if (r->provided())
+            {
+              auto w = std::find_if(cwins.begin(), cwins.end(),
+                                    [r](Item const *i) { return i->orig == r; });
+              if (w != cwins.end() && !(*w)->res->empty())
+                pending.push_back(*w);
+              continue;
+            }
+
+          if (r->empty() || !r->size())
+            continue;
+
+          if (!r->fixed_addr())
+            pending.push_back(copy(*c, r, false));
+          else if (root)
+            {
+              // fixed resources keep their place in the apertures
+              Item *i = copy(*c, r, false);
+              Item *w = window_for(wins, i->res);
+              if (w)
+                w->res->provided()->request(w->res, node, i->res, *c);
+            }
+        }
+    }
+
+  std::stable_sort(pending.begin(), pending.end(),
+                   [](Item const *l, Item const *r)
+                   {
+                     if (l->res->alignment() != r->res->alignment())
+                       return l->res->alignment() > r->res->alignment();
+                     return l->res->size() > r->res->size();
+                   });
+
+  for (Item *i: pending)
+    {
+      Item *w = window_for(wins, i->res);
+      if (!w)
+        continue;
+
+      if (!root)
+        w->res->provided()->assign(w->res, i->res);
+      else
+        i->placed = w->res->provided()->alloc(w->res, node, i->res, i->dev,
+                                              false);
+
+      w->children.push_back(i);
+    }
+}
+
+char const *
+type_name(Resource const *r)
+{
+  if (r->type() == Resource::Io_res)
+    return "io";
+  if (!r->prefetchable())
+    return r->is_64bit() ? "mem64" : "mem";
+  return r->is_64bit() ? "pref64" : "pref";
+}
+
+void
+report(Item const &i, bool placed, int indent)
+{
+  Resource const *r = i.orig;
+  Resource const *g = i.res;
+
+  printf("%*s%-12s %-6s", indent, "", i.dev->name(), type_name(r));
+
+  if (r->empty())
+    printf(" firmware: <unassigned>             ");
+  else
+    printf(" firmware: [%010llx-%010llx]",
+           (unsigned long long)r->start(), (unsigned long long)r->end());
+
+  if (g->empty())
+    printf("  global: <unused>\n");
+  else if (!placed)
+    printf("  global: <no space> size %llx\n", (unsigned long long)g->size());
+  else
+    printf("  global: [%010llx-%010llx]%s\n",
+           (unsigned long long)g->start(), (unsigned long long)g->end(),
+           (!r->empty() && r->size() < g->size()) ? "  firmware too small" : "");
+
+  for (Item const *c: i.children)
+    if (c->res->provided())
+      report(*c, placed, indent + 2);
+}
+
+}
+
+void
+report_global_alloc(Hw::Device *root)
+{
+  Shadow_tree shadow;
+  std::vector<Item *> apertures = shadow.windows(root, true);
+  shadow.alloc_children(root, apertures, true);
+
+  printf("PCI allocation dry run below %s:\n", root->name());
+
+  if (apertures.empty())
+    {
+      printf("  no root bridge apertures known\n");
+      return;
+    }
+
+  for (Item const *a: apertures)
+    {
+      unsigned failed = 0;
+      Resource::Size need = 0;
+      for (Item const *c: a->children)
+        {
+          need += c->res->size();
+          if (!c->placed)
+            ++failed;
+        }
+
+      printf("  aperture %-6s [%010llx-%010llx]: %u resources, %llx bytes "
+             "needed%s\n",
+             type_name(a->orig), (unsigned long long)a->orig->start(),
+             (unsigned long long)a->orig->end(),
+             (unsigned)a->children.size(), (unsigned long long)need,
+             failed ? ", does not fit" : "");
+
+      for (Item const *c: a->children)
+        if (c->res->provided())
+          report(*c, c->placed, 4);
+    }
+}
+
+} }
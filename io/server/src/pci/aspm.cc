@@ -0,0 +1,498 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include <pci-tuning.h>
+#include <pci-bridge.h>
+#include <pci-caps.h>
+
+#include "debug.h"
+#include "hw_device.h"
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace Hw { namespace Pci {
+
+namespace {
+
+enum Link_states
+{
+  S_l0s   = 1 << 0, ///< ASPM L0s, the encoding of Link_ctrl::aspm_ctrl
+  S_l1    = 1 << 1, ///< ASPM L1, the encoding of Link_ctrl::aspm_ctrl
+  S_l1_1  = 1 << 2, ///< ASPM L1.1
+  S_l1_2  = 1 << 3, ///< ASPM L1.2
+  S_aspm  = S_l0s | S_l1,
+  S_l1ss  = S_l1_1 | S_l1_2,
+};
+
+enum Pcie_types
+{
+  T_root_port       = 4,
+  T_upstream_port   = 5,
+  T_downstream_port = 6,
+};
+
+unsigned pcie_type(Dev *dev)
+{ return dev->pcie_cap().read<Pcie_cap::Flags>().type(); }
+
+/// L0s exit latency of a function in ns.
+unsigned l0s_exit_latency(Dev *dev)
+{
+  auto caps = dev->pcie_cap().read<Pcie_cap::Link_caps>();
+  unsigned enc = caps.l0s_exit_latency();
+  return enc == 7 ? 5000 : 64U << enc;
+}
+
+/// L1 exit latency of a function in ns.
+unsigned l1_exit_latency(Dev *dev)
+{
+  auto caps = dev->pcie_cap().read<Pcie_cap::Link_caps>();
+  unsigned enc = caps.l1_exit_latency();
+  return enc == 7 ? 65000 : 1000U << enc;
+}
+
+/// L1 PM Substates supported for ASPM by a function.
+unsigned l1ss_states(Dev *dev)
+{
+  Extended_cap cap = dev->find_ext_cap(L1ss_cap::Id);
+  if (!cap.is_valid())
+    return 0;
+
+  auto caps = cap.read<L1ss_cap::Caps>();
+  if (!caps.l1ss_supported())
+    return 0;
+
+  unsigned s = 0;
+  if (caps.aspm_l1_1())
+    s |= S_l1_1;
+
+  // L1.2 is entered based on the LTR values, so LTR must be enabled already
+  Cap pcie = dev->pcie_cap();
+  if (caps.aspm_l1_2()
+      && pcie.read<Pcie_cap::Flags>().version() >= 2
+      && pcie.read<Pcie_cap::Dev_ctrl2>().ltr_enable())
+    s |= S_l1_2;
+
+  return s;
+}
+
+/// Link states supported by a function.
+unsigned supported_states(Dev *dev)
+{
+  unsigned s = dev->pcie_cap().read<Pcie_cap::Link_caps>().aspm_support();
+  if (s & S_l1)
+    s |= l1ss_states(dev);
+  return s;
+}
+
+/// Link states currently enabled at a function.
+unsigned current_states(Dev *dev)
+{
+  unsigned s = dev->pcie_cap().read<Pcie_cap::Link_ctrl>().aspm_ctrl();
+
+  Extended_cap cap = dev->find_ext_cap(L1ss_cap::Id);
+  if (cap.is_valid())
+    {
+      auto ctrl = cap.read<L1ss_cap::Ctrl1>();
+      if (ctrl.aspm_l1_1())
+        s |= S_l1_1;
+      if (ctrl.aspm_l1_2())
+        s |= S_l1_2;
+    }
+
+  return s;
+}
+
+/**
+ * A PCIe link between a downstream port and the functions of the device
+ * below it.
+ */
+struct Link
+{
+  Dev *port;
+  Link *parent;
+  std::vector<Dev *> fns;
+  int policy = -1;
+  unsigned states = 0;
+  unsigned l0s_latency = 0;
+  unsigned l1_latency = 0;
+
+  Link(Dev *port, Link *parent) : port(port), parent(parent) {}
+
+  void add(Dev *fn, int p)
+  {
+    fns.push_back(fn);
+    policy = std::max(policy, p);
+  }
+
+  /// Compute the states supported by both ends and their exit latencies.
+  void init()
+  {
+    states = supported_states(port);
+    l0s_latency = l0s_exit_latency(port);
+    l1_latency = l1_exit_latency(port);
+
+    for (Dev *fn: fns)
+      {
+        states &= supported_states(fn);
+        l0s_latency = std::max(l0s_latency, l0s_exit_latency(fn));
+        l1_latency = std::max(l1_latency, l1_exit_latency(fn));
+      }
+
+    if (!(states & S_l1))
+      states &= ~S_l1ss;
+  }
+};
+
+struct Endpoint
+{
+  Dev *dev;
+  Link *link;
+};
+
+class Aspm_property : public String_property
+{
+public:
+  using String_property::set;
+  int set(int k, std::string const &str) override
+  {
+    static char const *const names[] =
+      { "default", "powersave", "performance" };
+
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+      if (str == names[i])
+        {
+          int r = String_property::set(k, str);
+          if (r < 0)
+            return r;
+
+          _policy = i;
+          Pcie_tuning::configure_all();
+          return 0;
+        }
+
+    d_printf(DBG_ERR, "error: unknown ASPM policy '%s'\n", str.c_str());
+    return -EINVAL;
+  }
+
+  /// The policy selected for the subtree, -1 if not set.
+  int policy() const { return _policy; }
+
+private:
+  int _policy = -1;
+};
+
+int node_policy(Hw::Device *d, int inherited)
+{
+  auto *p = dynamic_cast<Aspm_property *>(d->property("pcie_aspm"));
+  if (p && p->policy() >= 0)
+    return p->policy();
+  return inherited;
+}
+
+int inherited_policy(Hw::Device *d)
+{
+  if (!d)
+    return -1;
+  return node_policy(d, inherited_policy(d->parent()));
+}
+
+/**
+ * Collect the links below the bus of `node`.
+ *
+ * \param fn_link    Link the functions on the bus are attached to, nullptr
+ *                   for the root bus and internal switch buses.
+ * \param path_link  Link above the bus.
+ */
+void collect_links(Hw::Device *node, Link *fn_link, Link *path_link,
+                   int policy, std::deque<Link> *links,
+                   std::vector<Endpoint> *endpoints)
+{
+  for (auto c = node->begin(0); c != node->end(); ++c)
+    {
+      Dev *dev = Pcie_tuning::pcie_fn(*c);
+      if (!dev)
+        continue;
+
+      int p = node_policy(*c, policy);
+      if (fn_link)
+        fn_link->add(dev, p);
+
+      if (!dynamic_cast<Bridge_base *>(dev))
+        {
+          if (fn_link)
+            endpoints->push_back(Endpoint{dev, fn_link});
+          continue;
+        }
+
+      switch (pcie_type(dev))
+        {
+        case T_root_port:
+        case T_downstream_port:
+          links->emplace_back(dev, path_link);
+          collect_links(*c, &links->back(), &links->back(), p, links,
+                        endpoints);
+          break;
+        case T_upstream_port:
+          collect_links(*c, nullptr, path_link, p, links, endpoints);
+          break;
+        default:
+          // no PCIe links below PCIe-to-PCI bridges
+          break;
+        }
+    }
+}
+
+/**
+ * Drop the states of the links above an endpoint whose exit latencies exceed
+ * the latencies acceptable for the endpoint.
+ */
+void check_latencies(Endpoint const &ep)
+{
+  auto caps = ep.dev->pcie_cap().read<Pcie_cap::Dev_caps>();
+  unsigned acc_l0s = caps.l0s_acceptable_latency() == 7
+                     ? ~0U : 64U << caps.l0s_acceptable_latency();
+  unsigned acc_l1 = caps.l1_acceptable_latency() == 7
+                    ? ~0U : 1000U << caps.l1_acceptable_latency();
+
+  // L1 exits of the links on the path overlap, each switch adds up to 1us
+  unsigned l1_max = 0;
+  unsigned l1_switch = 0;
+  for (Link *l = ep.link; l; l = l->parent)
+    {
+      if ((l->states & S_l0s) && l->l0s_latency > acc_l0s)
+        l->states &= ~S_l0s;
+
+      l1_max = std::max(l1_max, l->l1_latency);
+      if ((l->states & S_l1) && l1_max + l1_switch > acc_l1)
+        l->states &= ~(S_l1 | S_l1ss);
+
+      l1_switch += 1000;
+    }
+}
+
+void set_aspm(Dev *dev, unsigned states)
+{
+  Cap pcie = dev->pcie_cap();
+  auto ctrl = pcie.read<Pcie_cap::Link_ctrl>();
+  if (ctrl.aspm_ctrl() == (states & S_aspm))
+    return;
+
+  ctrl.aspm_ctrl() = states & S_aspm;
+  pcie.write(ctrl);
+}
+
+void set_l1ss(Dev *dev, unsigned states)
+{
+  Extended_cap cap = dev->find_ext_cap(L1ss_cap::Id);
+  if (!cap.is_valid())
+    return;
+
+  auto ctrl = cap.read<L1ss_cap::Ctrl1>();
+  auto old = ctrl;
+  ctrl.aspm_l1_1() = !!(states & S_l1_1);
+  ctrl.aspm_l1_2() = !!(states & S_l1_2);
+  if (ctrl.v != old.v)
+    cap.write(ctrl);
+}
+
+/// T_POWER_ON of a function in us.
+unsigned t_power_on(L1ss_cap::Caps caps)
+{
+  static unsigned const scale[] = { 2, 10, 100, 100 };
+  return caps.t_power_on_value() * scale[caps.t_power_on_scale()];
+}
+
+/**
+ * Program the L1.2 timing parameters of both ends of a link.
+ *
+ * The common mode restore time and T_POWER_ON are the maximum of both ends,
+ * the LTR threshold covers the complete exit from L1.2.
+ */
+void set_l1_2_timing(Link const &l)
+{
+  unsigned cmrt = 0;
+  unsigned pwr_on = 0;
+  L1ss_cap::Caps pwr_on_caps;
+  pwr_on_caps.v = 0;
+
+  auto collect = [&](Dev *d)
+    {
+      auto caps = d->find_ext_cap(L1ss_cap::Id).read<L1ss_cap::Caps>();
+      cmrt = std::max<unsigned>(cmrt, caps.common_mode_restore_time());
+      if (t_power_on(caps) >= pwr_on)
+        {
+          pwr_on = t_power_on(caps);
+          pwr_on_caps = caps;
+        }
+    };
+
+  collect(l.port);
+  for (Dev *fn: l.fns)
+    collect(fn);
+
+  l4_uint64_t threshold = (l4_uint64_t{cmrt} + pwr_on + 6) * 1000;
+  unsigned scale = 0;
+  while (scale < 5 && (threshold >> (5 * scale)) > 0x3ff)
+    ++scale;
+  unsigned value = std::min<l4_uint64_t>(threshold >> (5 * scale), 0x3ff);
+
+  auto program = [&](Dev *d, bool upstream)
+    {
+      Extended_cap cap = d->find_ext_cap(L1ss_cap::Id);
+      auto ctrl2 = cap.read<L1ss_cap::Ctrl2>();
+      ctrl2.t_power_on_scale() = pwr_on_caps.t_power_on_scale();
+      ctrl2.t_power_on_value() = pwr_on_caps.t_power_on_value();
+      cap.write(ctrl2);
+
+      auto ctrl1 = cap.read<L1ss_cap::Ctrl1>();
+      if (upstream)
+        ctrl1.common_mode_restore_time() = cmrt;
+      ctrl1.ltr_l1_2_threshold_value() = value;
+      ctrl1.ltr_l1_2_threshold_scale() = scale;
+      cap.write(ctrl1);
+    };
+
+  program(l.port, true);
+  for (Dev *fn: l.fns)
+    program(fn, false);
+}
+
+/**
+ * Apply the states of a link to both ends.
+ *
+ * The L1 PM Substates must only be changed while ASPM L1 is disabled. ASPM is
+ * disabled at the downstream end first and enabled at the upstream end first.
+ */
+void configure_link(Link const &l)
+{
+  unsigned cur = current_states(l.port);
+  bool changed = cur != l.states;
+  for (Dev *fn: l.fns)
+    if (current_states(fn) != l.states)
+      changed = true;
+
+  if (!changed)
+    return;
+
+  for (Dev *fn: l.fns)
+    set_aspm(fn, 0);
+  set_aspm(l.port, 0);
+
+  for (Dev *fn: l.fns)
+    set_l1ss(fn, 0);
+  set_l1ss(l.port, 0);
+
+  if (l.states & S_l1_2)
+    set_l1_2_timing(l);
+
+  set_l1ss(l.port, l.states);
+  for (Dev *fn: l.fns)
+    set_l1ss(fn, l.states);
+
+  set_aspm(l.port, l.states);
+  for (Dev *fn: l.fns)
+    set_aspm(fn, l.states);
+
+  d_printf(DBG_DEBUG, "%02x:%02x.%x: ASPM%s%s%s%s%s\n",
+           l.port->bus_nr(), l.port->device_nr(), l.port->function_nr(),
+           l.states & S_l0s ? " L0s" : "", l.states & S_l1 ? " L1" : "",
+           l.states & S_l1_1 ? " L1.1" : "", l.states & S_l1_2 ? " L1.2" : "",
+           l.states ? "" : " disabled");
+}
+
+class Saved_l1ss_cap : public Saved_cap
+{
+public:
+  Saved_l1ss_cap(unsigned offset, unsigned pcie_offset)
+  : Saved_cap(L1ss_cap::Id, offset), _pcie(pcie_offset)
+  {}
+
+private:
+  unsigned _pcie;
+  l4_uint32_t _ctrl1;
+  l4_uint32_t _ctrl2;
+
+  void _save(Config cap) override
+  {
+    cap.read(L1ss_cap::Ctrl1::Ofs, &_ctrl1);
+    cap.read(L1ss_cap::Ctrl2::Ofs, &_ctrl2);
+  }
+
+  void _restore(Config cap) override
+  {
+    // The PCIe capability with the link control register is restored
+    // before. Disable ASPM while the substates are restored.
+    Config pcie(cap.addr().base() + _pcie, cap.cfg_spc());
+    auto link = pcie.read<Pcie_cap::Link_ctrl>();
+    auto no_aspm = link;
+    no_aspm.aspm_ctrl() = 0;
+    pcie.write(no_aspm);
+
+    cap.write(L1ss_cap::Ctrl2::Ofs, _ctrl2);
+    cap.write(L1ss_cap::Ctrl1::Ofs, _ctrl1);
+
+    pcie.write(link);
+  }
+};
+
+}
+
+void
+Pcie_tuning::add_aspm_property(Hw::Device *dev)
+{
+  dev->register_property("pcie_aspm", new Aspm_property());
+}
+
+void
+Pcie_tuning::add_aspm_device(Dev *dev)
+{
+  add_aspm_property(dev->host());
+
+  Extended_cap cap = dev->find_ext_cap(L1ss_cap::Id);
+  if (cap.is_valid())
+    dev->add_saved_cap(new Saved_l1ss_cap(cap.reg(), dev->pcie_cap().reg()));
+}
+
+void
+Pcie_tuning::configure_aspm(Hw::Device *root)
+{
+  std::deque<Link> links;
+  std::vector<Endpoint> endpoints;
+  collect_links(root, nullptr, nullptr, inherited_policy(root), &links,
+                &endpoints);
+
+  for (Link &l: links)
+    {
+      if (l.fns.empty())
+        continue;
+
+      switch (l.policy)
+        {
+        case Aspm_powersave:
+          l.init();
+          break;
+        case Aspm_performance:
+          l.states = 0;
+          break;
+        default:
+          break;
+        }
+    }
+
+  for (Endpoint const &ep: endpoints)
+    check_latencies(ep);
+
+  // links closer to the root come first
+  for (Link const &l: links)
+    if (!l.fns.empty()
+        && (l.policy == Aspm_powersave || l.policy == Aspm_performance))
+      configure_link(l);
+}
+
+} }
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include <pci-enum-cache.h>
+#include <pci-dev.h>
+#include <hw_device.h>
+
+#include <l4/re/env>
+#include <l4/re/dataspace>
+#include <l4/re/rm>
+
+#include <cstring>
+
+#include "debug.h"
+#include "main.h"
+
+namespace Hw { namespace Pci {
+
+Enum_cache *
+Enum_cache::get()
+{
+  static Enum_cache c;
+  return &c;
+}
+
+l4_uint32_t
+Enum_cache::checksum(Entry const *e, unsigned num)
+{
+  // simple Fletcher-32 over the raw entries, enough to detect a truncated
+  // or partially written cache
+  auto const *p = reinterpret_cast<l4_uint16_t const *>(e);
+  l4_size_t words = num * sizeof(Entry) / 2;
+  l4_uint32_t s1 = 0xffff, s2 = 0xffff;
+  while (words)
+    {
+      l4_size_t n = words > 359 ? 359 : words;
+      words -= n;
+      do
+        {
+          s1 += *p++;
+          s2 += s1;
+        }
+      while (--n);
+      s1 = (s1 & 0xffff) + (s1 >> 16);
+      s2 = (s2 & 0xffff) + (s2 >> 16);
+    }
+  s1 = (s1 & 0xffff) + (s1 >> 16);
+  s2 = (s2 & 0xffff) + (s2 >> 16);
+  return (s2 << 16) | s1;
+}
+
+int
+Enum_cache::init(char const *cap_name)
+{
+  auto ds = L4Re::Env::env()->get_cap<L4Re::Dataspace>(cap_name);
+  if (!ds.is_valid())
+    {
+      d_printf(DBG_WARN, "warning: PCI enum cache: no capability '%s'\n",
+               cap_name);
+      return -L4_ENOENT;
+    }
+
+  _size = ds->size();
+  if (_size < sizeof(Header))
+    {
+      d_printf(DBG_WARN, "warning: PCI enum cache: dataspace too small\n");
+      return -L4_EINVAL;
+    }
+
+  _writable = ds->flags().w();
+
+  auto rm_flags = L4Re::Rm::F::Search_addr | L4Re::Rm::F::Eager_map
+                  | (_writable ? L4Re::Rm::F::RW : L4Re::Rm::F::R);
+  l4_addr_t addr = 0;
+  int r = L4Re::Env::env()->rm()->attach(&addr, _size, rm_flags,
+                                         L4::Ipc::make_cap(ds, _writable
+                                                               ? L4_CAP_FPAGE_RW
+                                                               : L4_CAP_FPAGE_RO));
+  if (r < 0)
+    {
+      d_printf(DBG_ERR, "error: PCI enum cache: cannot attach dataspace: %d\n",
+               r);
+      return r;
+    }
+
+  _buf = reinterpret_cast<char *>(addr);
+
+  auto const *h = reinterpret_cast<Header const *>(_buf);
+  auto const *e = reinterpret_cast<Entry const *>(h + 1);
+  l4_size_t max_entries = (_size - sizeof(Header)) / sizeof(Entry);
+
+  if (h->magic != Magic || h->version != Version
+      || h->num_entries > max_entries
+      || h->checksum != checksum(e, h->num_entries))
+    {
+      d_printf(DBG_INFO, "PCI enum cache: empty or invalid, doing full scan\n");
+      _stale = true;
+      return -L4_EINVAL;
+    }
+
+  for (unsigned i = 0; i < h->num_entries; ++i)
+    _entries[e[i].bdf] = e[i];
+
+  d_printf(DBG_INFO, "PCI enum cache: loaded %u entries\n", h->num_entries);
+  return 0;
+}
+
+Enum_cache::Entry const *
+Enum_cache::lookup(unsigned segment, Config_cache const &cc)
+{
+  if (!_buf)
+    return nullptr;
+
+  auto i = _entries.find(bdf(segment, cc.addr().bus(), cc.addr().devfn()));
+  if (i == _entries.end())
+    {
+      _stale = true;
+      return nullptr;
+    }
+
+  Entry const &e = i->second;
+  if (e.vendor_device != cc.vendor_device || e.cls_rev != cc.cls_rev
+      || e.hdr_type != cc.hdr_type)
+    {
+      d_printf(DBG_DEBUG, "PCI enum cache: %04x:%02x:%02x.%x changed\n",
+               segment, cc.addr().bus(), cc.addr().dev(), cc.addr().fn());
+      _entries.erase(i);
+      _stale = true;
+      return nullptr;
+    }
+
+  ++_hits;
+  return &e;
+}
+
+static void
+fill_bar(Enum_cache::Bar *b, Resource const *r)
+{
+  memset(b, 0, sizeof(*b));
+  if (!r)
+    return;
+
+  b->flags = Enum_cache::Bf_valid;
+  if (r->type() == Resource::Io_res)
+    b->flags |= Enum_cache::Bf_io;
+  if (r->is_64bit())
+    b->flags |= Enum_cache::Bf_64bit;
+  if (r->prefetchable())
+    b->flags |= Enum_cache::Bf_prefetch;
+
+  b->size = r->size();
+  // only remember addresses that were successfully placed
+  b->start = r->disabled() ? 0 : r->start();
+}
+
+void
+Enum_cache::store()
+{
+  if (!_buf)
+    return;
+
+  // everything we found was in the cache, and nothing vanished
+  if (!_stale && _hits == _entries.size())
+    {
+      d_printf(DBG_INFO, "PCI enum cache: %u hits, cache up to date\n", _hits);
+      return;
+    }
+
+  if (!_writable)
+    {
+      d_printf(DBG_WARN, "warning: PCI enum cache: stale but read-only\n");
+      return;
+    }
+
+  auto *h = reinterpret_cast<Header *>(_buf);
+  auto *e = reinterpret_cast<Entry *>(h + 1);
+  l4_size_t max_entries = (_size - sizeof(Header)) / sizeof(Entry);
+  unsigned n = 0;
+
+  // invalidate first, so that an interrupted update is never taken as valid
+  h->magic = 0;
+
+  for (auto i = Hw::Device::iterator(0, system_bus(), L4VBUS_MAX_DEPTH);
+       i != system_bus()->end(); ++i)
+    {
+      Dev *d = (*i)->find_feature<Dev>();
+      if (!d)
+        continue;
+
+      if (n >= max_entries)
+        {
+          d_printf(DBG_WARN, "warning: PCI enum cache: dataspace too small "
+                             "for %u+ functions\n", n);
+          return;
+        }
+
+      Entry *c = &e[n++];
+      memset(c, 0, sizeof(*c));
+      c->bdf = bdf(d->segment_nr(), d->bus_nr(), d->devfn());
+      c->vendor_device = d->cfg.vendor_device;
+      c->cls_rev = d->cfg.cls_rev;
+      c->hdr_type = d->cfg.hdr_type;
+
+      for (int b = 0; b < d->cfg.nbars(); ++b)
+        fill_bar(&c->bars[b], d->bar(b));
+
+      fill_bar(&c->rom, (*i)->resources()->find("ROM"));
+    }
+
+  h->num_entries = n;
+  h->checksum = checksum(e, n);
+  h->version = Version;
+  h->magic = Magic;
+
+  d_printf(DBG_INFO, "PCI enum cache: stored %u entries\n", n);
+}
+
+} }
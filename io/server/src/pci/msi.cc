@@ -11,6 +11,9 @@
 #include "debug.h"
 #include "hw_msi.h"
 #include "main.h"
+#include "res.h"
+
+#include <string>
 
 namespace Hw { namespace Pci {
 
@@ -106,40 +109,70 @@ public:
   static unsigned data(int vector) { return vector & 0xff; }
 };
 
-class Msi_res : public Hw::Msi_resource, public Transparent_msi
+/**
+ * An MSI or MSI-X message of a device provided to clients as an ordinary
+ * interrupt.
+ */
+class Msi_res_base : public Hw::Msi_resource, public Transparent_msi
 {
 public:
-  Msi_res(unsigned msi, Dev *dev, l4_uint32_t cap_offset)
+  Msi_res_base(unsigned msi, unsigned long mode, Dev *dev,
+               l4_uint32_t cap_offset)
   : Msi_resource(msi), _dev(dev), _cap(cap_offset)
-  {}
+  { add_flags(mode); }
 
   int bind(Triggerable const &irq, unsigned mode) override;
   int unbind(bool deleted) override;
   int msi_info(Msi_src *, l4_icu_msi_info_t *) override
   { return -L4_EINVAL; }
 
-  void dump(int indent) const override
-  { Resource::dump("MSI   ", indent);  }
-
   l4_uint32_t filter_cmd_read(l4_uint32_t cmd) override;
   l4_uint16_t filter_cmd_write(l4_uint16_t cmd, l4_uint16_t ocmd) override;
 
-private:
-  void setup_cap(l4_uint16_t ctl, l4_uint16_t cmd);
+protected:
+  /// Program the message, enable it and disable INTx.
+  virtual void setup_cap(l4_uint16_t cmd) = 0;
+  virtual bool msg_enabled() const = 0;
+  virtual void disable_msg() = 0;
+
   Dev *_dev;
   l4_uint32_t _cap;
   l4_icu_msi_info_t _msg;
 };
 
+class Msi_res : public Msi_res_base
+{
+public:
+  Msi_res(unsigned msi, Dev *dev, l4_uint32_t cap_offset)
+  : Msi_res_base(msi, Resource::Irq_mode_msi, dev, cap_offset)
+  {}
+
+  void dump(int indent) const override
+  { Resource::dump("MSI   ", indent);  }
+
+private:
+  void setup_cap(l4_uint16_t cmd) override;
+
+  bool msg_enabled() const override
+  { return _dev->config(_cap).read<l4_uint16_t>(2) & 1; }
+
+  void disable_msg() override
+  {
+    auto c = _dev->config(_cap);
+    c.write<l4_uint16_t>(2, c.read<l4_uint16_t>(2) & ~1);
+  }
+};
+
 void
-Msi_res::setup_cap(l4_uint16_t ctl, l4_uint16_t cmd)
+Msi_res::setup_cap(l4_uint16_t cmd)
 {
+  auto c = _dev->config();
+  l4_uint16_t ctl = c.read<l4_uint16_t>(_cap + 2);
+
   unsigned msg_offs = 8;
   if (ctl & (1 << 7))
     msg_offs = 12;
 
-  auto c = _dev->config();
-
   // disable INTx if not already
   if (!(cmd & Dev::CC_int_disable))
     c.write<l4_uint16_t>(Config::Command, cmd | Dev::CC_int_disable);
@@ -158,8 +191,108 @@ Msi_res::setup_cap(l4_uint16_t ctl, l4_uint16_t cmd)
            _cap, _msg.msi_addr, _msg.msi_data);
 }
 
+/**
+ * Transparent MSI-X using the first entry of the MSI-X table.
+ *
+ * All other entries stay masked.
+ */
+class Msix_res : public Msi_res_base
+{
+public:
+  Msix_res(unsigned msi, Dev *dev, l4_uint32_t cap_offset)
+  : Msi_res_base(msi, Resource::Irq_mode_msix, dev, cap_offset)
+  {}
+
+  void dump(int indent) const override
+  { Resource::dump("MSI-X ", indent);  }
+
+  /// Program the message again, e.g. after resume.
+  void restore()
+  {
+    if (irq())
+      setup_cap(_dev->config().read<l4_uint16_t>(Config::Command));
+  }
+
+private:
+  enum
+  {
+    Ctrl         = 0x02,
+    Table        = 0x04,
+    Ctrl_enable  = 1 << 15,
+    Ctrl_fn_mask = 1 << 14,
+
+    Entry_addr_lo = 0x0,
+    Entry_addr_hi = 0x4,
+    Entry_data    = 0x8,
+    Entry_ctrl    = 0xc,
+  };
+
+  l4_addr_t _table = 0;
+
+  l4_addr_t table();
+  void write_entry(unsigned reg, l4_uint32_t v)
+  { *reinterpret_cast<l4_uint32_t volatile *>(_table + reg) = v; }
+
+  void setup_cap(l4_uint16_t cmd) override;
+
+  bool msg_enabled() const override
+  { return _dev->config(_cap).read<l4_uint16_t>(Ctrl) & Ctrl_enable; }
+
+  void disable_msg() override
+  {
+    auto c = _dev->config(_cap);
+    c.write<l4_uint16_t>(Ctrl, c.read<l4_uint16_t>(Ctrl) & ~Ctrl_enable);
+  }
+};
+
+l4_addr_t
+Msix_res::table()
+{
+  if (_table)
+    return _table;
+
+  l4_uint32_t t = _dev->config(_cap).read<l4_uint32_t>(Table);
+  Resource *bar = _dev->bar(t & 7);
+  if (!bar || bar->empty() || bar->type() != Resource::Mmio_res)
+    return 0;
+
+  _table = res_map_iomem(bar->start() + (t & ~7U), L4_PAGESIZE);
+  return _table;
+}
+
+void
+Msix_res::setup_cap(l4_uint16_t cmd)
+{
+  if (!table())
+    {
+      d_printf(DBG_ERR, "ERROR: %02x:%02x.%x: cannot map MSI-X table\n",
+               _dev->bus_nr(), _dev->device_nr(), _dev->function_nr());
+      return;
+    }
+
+  auto c = _dev->config();
+  l4_uint16_t ctl = c.read<l4_uint16_t>(_cap + Ctrl);
+
+  // the table is only accessible with memory decoding enabled
+  c.write<l4_uint16_t>(Config::Command,
+                       cmd | Dev::CC_mem | Dev::CC_int_disable);
+  c.write<l4_uint16_t>(_cap + Ctrl, ctl | Ctrl_enable | Ctrl_fn_mask);
+
+  write_entry(Entry_addr_lo, _msg.msi_addr);
+  write_entry(Entry_addr_hi, _msg.msi_addr >> 32);
+  write_entry(Entry_data, _msg.msi_data);
+  write_entry(Entry_ctrl, 0);
+
+  c.write<l4_uint16_t>(_cap + Ctrl, (ctl | Ctrl_enable) & ~Ctrl_fn_mask);
+  c.write<l4_uint16_t>(Config::Command, cmd | Dev::CC_int_disable);
+
+  d_printf(DBG_DEBUG2, "MSI-X: enable kernel PIN=%x hwpci=%02x:%02x.%x: reg=%03x msg=%llx:%x\n",
+           pin(), _dev->bus_nr(), _dev->device_nr(), _dev->function_nr(),
+           _cap, _msg.msi_addr, _msg.msi_data);
+}
+
 int
-Msi_res::bind(Triggerable const &irq, unsigned mode)
+Msi_res_base::bind(Triggerable const &irq, unsigned mode)
 {
   int err = Msi_resource::bind(irq, mode);
   if (err < 0)
@@ -183,27 +316,19 @@ Msi_res::bind(Triggerable const &irq, unsigned mode)
       return e2;
     }
 
-  // MSI capability
-  auto c = _dev->config();
-  l4_uint16_t ctl = c.read<l4_uint16_t>(_cap + 2);
-  setup_cap(ctl, c.read<l4_uint16_t>(Config::Command));
+  setup_cap(_dev->config().read<l4_uint16_t>(Config::Command));
   return 0;
 }
 
 int
-Msi_res::unbind(bool deleted)
+Msi_res_base::unbind(bool deleted)
 {
-  // disable MSI
-  auto c = _dev->config(_cap);
-  l4_uint16_t ctl;
-  ctl = c.read<l4_uint16_t>(2);
-  c.write<l4_uint16_t>(2, ctl & ~1);
-
+  disable_msg();
   return Msi_resource::unbind(deleted);
 }
 
 l4_uint32_t
-Msi_res::filter_cmd_read(l4_uint32_t cmd)
+Msi_res_base::filter_cmd_read(l4_uint32_t cmd)
 {
   auto c = _dev->config();
   if (!this->irq())
@@ -216,16 +341,15 @@ Msi_res::filter_cmd_read(l4_uint32_t cmd)
       return cmd;
     }
 
-  l4_uint16_t ctl = c.read<l4_uint16_t>(_cap + 2);
-  if (!(cmd & Dev::CC_int_disable) || !(ctl & 1))
+  if (!(cmd & Dev::CC_int_disable) || !msg_enabled())
     // MSI was disabled, rewrite the MSI cap
-    setup_cap(ctl, cmd);
+    setup_cap(cmd);
 
   return cmd;
 }
 
 l4_uint16_t
-Msi_res::filter_cmd_write(l4_uint16_t cmd, l4_uint16_t ocmd)
+Msi_res_base::filter_cmd_write(l4_uint16_t cmd, l4_uint16_t ocmd)
 {
   if (!this->irq())
     {
@@ -233,45 +357,169 @@ Msi_res::filter_cmd_write(l4_uint16_t cmd, l4_uint16_t ocmd)
       return cmd;
     }
 
-  l4_uint16_t ctl = _dev->config(_cap).read<l4_uint16_t>(2);
-  if (!(ocmd & Dev::CC_int_disable) || !(ctl & 1))
+  if (!(ocmd & Dev::CC_int_disable) || !msg_enabled())
     // MSI was disabled, rewrite the MSI cap
-    setup_cap(ctl, ocmd);
+    setup_cap(ocmd);
 
   cmd |= Dev::CC_int_disable;
   return cmd;
 }
 
-}
+class Saved_msix_cap : public Saved_cap
+{
+public:
+  Saved_msix_cap(unsigned pos, Msix_res *res)
+  : Saved_cap(Cap::Msi_x, pos), _res(res)
+  {}
+
+private:
+  Msix_res *_res;
 
+  // the MSI-X table is in device memory, program the message again instead
+  void _save(Config) override {}
+  void _restore(Config) override { _res->restore(); }
+};
 
-void
-Dev::parse_msi_cap(Cfg_addr cap_ptr)
+class Irq_mode_property : public String_property
 {
-  if (   !Io_config::cfg->transparent_msi(host())
-      || !system_icu()->info.supports_msi())
-    return;
+public:
+  explicit Irq_mode_property(Dev *dev) : _dev(dev) {}
 
-  unsigned msi = _last_msi++;
+  using String_property::set;
+  int set(int k, std::string const &str) override
+  {
+    static char const *const names[] = { "intx", "msi", "msix", "auto" };
 
-  for (Resource_list::const_iterator i = host()->resources()->begin();
-      i != host()->resources()->end(); ++i)
-    {
-      if ((*i)->type() == Resource::Irq_res)
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+      if (str == names[i])
         {
-          (*i)->set_empty();
-          (*i)->add_flags(Resource::F_disabled);
+          int r = _dev->set_irq_mode(Dev::Irq_mode(i));
+          if (r < 0)
+            return r;
+
+          return String_property::set(k, str);
         }
-    }
 
-  d_printf(DBG_DEBUG, "Use MSI PCI device %02x:%02x:%x: pin=%x\n",
-           bus_nr(), host()->adr() >> 16, host()->adr() & 0xff, msi);
+    d_printf(DBG_ERR, "error: unknown IRQ mode '%s'\n", str.c_str());
+    return -EINVAL;
+  }
+
+private:
+  Dev *_dev;
+};
+
+}
+
+
+Resource *
+Dev::create_msi_res(bool msix)
+{
+  unsigned msi = _last_msi++;
+  Resource *res;
+
+  if (msix)
+    {
+      auto *r = new Msix_res(msi, this, _msix_cap);
+      _saved_state.add_cap(new Saved_msix_cap(_msix_cap, r));
+      res = r;
+    }
+  else
+    {
+      res = new Msi_res(msi, this, _msi_cap);
+      _saved_state.add_cap(new Saved_msi_cap(_msi_cap));
+    }
 
-  auto *res = new Msi_res(msi, this, cap_ptr.reg());
-  flags.msi() = true;
   _host->add_resource_rq(res);
-  _transp_msi = res;
-  _saved_state.add_cap(new Saved_msi_cap(cap_ptr.reg()));
+  return res;
+}
+
+int
+Dev::set_irq_mode(Irq_mode mode)
+{
+  bool msi_ok = system_icu()->info.supports_msi();
+
+  if (mode == Irq_auto)
+    {
+      // multi-queue devices use MSI-X to be able to use more vectors later
+      unsigned vectors = 0;
+      if (_msix_cap)
+        vectors = (config(_msix_cap).read<l4_uint16_t>(2) & 0x7ff) + 1;
+
+      if (!msi_ok)
+        mode = Irq_intx;
+      else if (vectors > 1 || (_msix_cap && !_msi_cap))
+        mode = Irq_msix;
+      else if (_msi_cap)
+        mode = Irq_msi;
+      else
+        mode = Irq_intx;
+    }
+
+  if ((mode == Irq_msi && !_msi_cap) || (mode == Irq_msix && !_msix_cap))
+    return -L4_ENODEV;
+
+  if (mode != Irq_intx && !msi_ok)
+    return -L4_ENOSYS;
+
+  if (mode == _irq_mode)
+    return 0;
+
+  if (_host->ref_count())
+    return -L4_EBUSY;
+
+  Resource *res = nullptr;
+  if (mode == Irq_msi)
+    {
+      if (!_msi_res)
+        _msi_res = create_msi_res(false);
+      res = _msi_res;
+    }
+  else if (mode == Irq_msix)
+    {
+      if (!_msix_res)
+        _msix_res = create_msi_res(true);
+      res = _msix_res;
+    }
+
+  for (Resource *r: *host()->resources())
+    {
+      if (!r || r->type() != Resource::Irq_res)
+        continue;
+
+      bool use;
+      if (r == _msi_res || r == _msix_res)
+        use = r == res;
+      else
+        use = mode == Irq_intx;
+
+      if (use)
+        r->enable();
+      else
+        r->disable();
+    }
+
+  _transp_msi = dynamic_cast<Transparent_msi *>(res);
+  flags.msi() = res != nullptr;
+  _irq_mode = mode;
+
+  static char const *const names[] = { "INTx", "MSI", "MSI-X" };
+  d_printf(DBG_DEBUG, "Use %s PCI device %02x:%02x.%x: pin=%llx\n",
+           names[mode], bus_nr(), device_nr(), function_nr(),
+           res ? res->start() : 0ULL);
+  return 0;
+}
+
+void
+Dev::setup_irq_mode()
+{
+  if (!_msi_cap && !_msix_cap)
+    return;
+
+  _host->register_property("irq_mode", new Irq_mode_property(this));
+
+  // --transparent-msi keeps to plain MSI, MSI-X only on explicit request
+  if (Io_config::cfg->transparent_msi(host()) && _msi_cap)
+    set_irq_mode(Irq_msi);
 }
 
 }}
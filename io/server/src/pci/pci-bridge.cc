@@ -8,8 +8,12 @@
 #include <pci-bridge.h>
 #include <pci-caps.h>
 #include <pci-driver.h>
+#include <pci-tuning.h>
 #include <resource_provider.h>
 
+#include "cfg.h"
+#include "timing_stats.h"
+
 namespace Hw { namespace Pci {
 
 namespace {
@@ -128,15 +132,46 @@ Bridge::setup_children(Hw::Device *)
 
       c.write<l4_uint16_t>(Config::Command, c.read<l4_uint16_t>(0x04) | 3);
     }
+  else
+    c.write<l4_uint32_t>(Config::Mem_base, 0x0000fff0); // base > limit
 
   if (!pref_mmio->empty() && pref_mmio->valid())
     {
       l4_uint32_t v = (pref_mmio->start() >> 16) & 0xfff0;
       v |= pref_mmio->end() & 0xfff00000;
       c.write<l4_uint32_t>(Config::Pref_mem_base, v);
+      if (pref_mmio->is_64bit())
+        {
+          c.write<l4_uint32_t>(Config::Pref_mem_base_hi, pref_mmio->start() >> 32);
+          c.write<l4_uint32_t>(Config::Pref_mem_limit_hi, pref_mmio->end() >> 32);
+        }
       if (0)
         printf("%08x: set pref mmio to %08x\n", host()->adr(), v);
     }
+  else
+    {
+      c.write<l4_uint32_t>(Config::Pref_mem_base, 0x0000fff0);
+      if (pref_mmio->is_64bit())
+        {
+          c.write<l4_uint32_t>(Config::Pref_mem_base_hi, 0);
+          c.write<l4_uint32_t>(Config::Pref_mem_limit_hi, 0);
+        }
+    }
+
+  if (!io->empty() && io->valid())
+    {
+      l4_uint16_t v = (io->start() >> 8) & 0xf0;
+      v |= io->end() & 0xf000;
+      bool io32 = (c.read<l4_uint16_t>(Config::Io_base) & 0x0f) == 1;
+      c.write<l4_uint16_t>(Config::Io_base, v);
+      if (io32)
+        {
+          c.write<l4_uint16_t>(Config::Io_base_hi, io->start() >> 16);
+          c.write<l4_uint16_t>(Config::Io_limit_hi, io->end() >> 16);
+        }
+    }
+  else
+    c.write<l4_uint16_t>(Config::Io_base, 0x00f0);
 
   enable_bus_master();
 
@@ -153,6 +188,10 @@ Bridge::discover_resources(Hw::Device *host)
 
   auto c = config();
 
+  // With the global allocation the firmware windows are ignored, all windows
+  // are sized from the devices below and placed anew.
+  bool global = Io_config::cfg->pci_alloc() == Io_config::Pci_alloc_global;
+
   l4_uint32_t v;
   l4_uint64_t s, e;
 
@@ -160,12 +199,14 @@ Bridge::discover_resources(Hw::Device *host)
   s = (v & 0xfff0) << 16;
   e = (v & 0xfff00000) | 0xfffff;
 
-  Resource *r = new Resource_provider(Resource::Mmio_res | Resource::Mem_type_rw
-                                      | Resource::F_can_move
-                                      | Resource::F_can_resize);
+  Resource_provider *r =
+    new Resource_provider(Resource::Mmio_res | Resource::Mem_type_rw
+                          | Resource::F_can_move
+                          | Resource::F_can_resize);
   r->set_id("WIN0");
   r->alignment(0xfffff);
-  if (s < e)
+  r->granularity(0xfffff);
+  if (s < e && !global)
     r->start_end(s, e);
   else
     r->set_empty();
@@ -194,7 +235,8 @@ Bridge::discover_resources(Hw::Device *host)
     }
 
   r->alignment(0xfffff);
-  if (s < e)
+  r->granularity(0xfffff);
+  if (s < e && !global)
     r->start_end(s, e);
   else
     r->set_empty();
@@ -210,8 +252,16 @@ Bridge::discover_resources(Hw::Device *host)
   r = new Resource_provider(Resource::Io_res | Resource::F_can_move
                             | Resource::F_can_resize);
   r->set_id("WIN2");
+
+  if ((v & 0x0f) == 1) // 32-bit I/O addressing
+    {
+      s |= l4_uint32_t(c.read<l4_uint16_t>(Config::Io_base_hi)) << 16;
+      e |= l4_uint32_t(c.read<l4_uint16_t>(Config::Io_limit_hi)) << 16;
+    }
+
   r->alignment(0xfff);
-  if (s < e)
+  r->granularity(0xfff);
+  if (s < e && !global)
     r->start_end(s, e);
   else
     r->set_empty();
@@ -560,6 +610,7 @@ Bridge_base::discover_func(Hw::Device *host_bus, Config_space *cfg,
     }
 
   child->add_feature(d);
+  register_pci_device(d);
 
   // discover the resources of the new PCI device
   // NOTE: we do this here to have all child resources discovered and
@@ -568,9 +619,8 @@ Bridge_base::discover_func(Hw::Device *host_bus, Config_space *cfg,
   // that were not preset
   d->discover_resources(child);
 
-  Driver *drv = Driver::find(d);
-  if (drv)
-    drv->probe(d);
+  // asynchronous probes may still run while the bus below is discovered
+  Driver::probe_dev(d);
 
   // go down the PCI hierarchy recursively,
   // to assign bus numbers (if not yet assigned) the right way
@@ -591,7 +641,18 @@ Bridge_base::discover_bus(Hw::Device *host, Config_space *cfg)
       host->add_resource_rq(r);
     }
 
+  l4_uint64_t start = Timing_stats::now_us();
   discover_devices(host, cfg);
+
+  // the whole hierarchy is known once the root bridge returns
+  if (!parent_bridge())
+    {
+      Timing_stats::record_startup_step(L4VBUS_STARTUP_PCI_SCAN, start,
+                                        [host]{ return host->get_full_path(); });
+      Pcie_tuning::configure(host);
+      if (Io_config::cfg->pci_alloc() == Io_config::Pci_alloc_dry_run)
+        report_global_alloc(host);
+    }
 }
 
 void
@@ -11,10 +11,12 @@
 #include "main.h"
 #include "cfg.h"
 #include <pci-caps.h>
+#include <pci-tuning.h>
 // -----
 
 // for the printf in discover_pci_caps
 #include <cstdio>
+#include <map>
 
 #ifdef CONFIG_L4IO_PCIID_DB
 # include "pciids.h"
@@ -22,6 +24,58 @@
 
 namespace Hw { namespace Pci {
 
+namespace {
+
+class Saved_pcie_cap : public Saved_cap
+{
+public:
+  explicit Saved_pcie_cap(unsigned pos) : Saved_cap(Cap::Pcie, pos) {}
+
+private:
+  enum Regs
+  {
+    Dev_ctrl   = 0x08,
+    Link_ctrl  = 0x10,
+    Dev_ctrl2  = 0x28,
+    Link_ctrl2 = 0x30,
+  };
+
+  l4_uint16_t _dev_ctrl;
+  l4_uint16_t _link_ctrl;
+  l4_uint16_t _dev_ctrl2;
+  l4_uint16_t _link_ctrl2;
+  bool _v2;
+
+  void _save(Config cap) override
+  {
+    cap.read(Dev_ctrl, &_dev_ctrl);
+    cap.read(Link_ctrl, &_link_ctrl);
+
+    // the second set of registers exists since version 2 of the capability
+    _v2 = cap.read<Pcie_cap::Flags>().version() >= 2;
+    if (_v2)
+      {
+        cap.read(Dev_ctrl2, &_dev_ctrl2);
+        cap.read(Link_ctrl2, &_link_ctrl2);
+      }
+  }
+
+  void _restore(Config cap) override
+  {
+    // includes the MPS, MRRS and transaction feature settings, see
+    // Pcie_tuning
+    cap.write(Dev_ctrl, _dev_ctrl);
+    cap.write(Link_ctrl, _link_ctrl);
+    if (_v2)
+      {
+        cap.write(Dev_ctrl2, _dev_ctrl2);
+        cap.write(Link_ctrl2, _link_ctrl2);
+      }
+  }
+};
+
+}
+
 void
 Config_cache::_discover_pci_caps(Config const &c)
 {
@@ -60,6 +114,32 @@ Config_cache::fill(l4_uint32_t _vendor_device, Config const &c)
   *static_cast<Config *>(this) = c;
   vendor_device = _vendor_device;
 
+  {
+    // the function exists, the remaining header and capability reads go to
+    // the same function
+    Cfg_batch batch(c);
+    _read_header(c);
+    if (batch.end() == 0)
+      return;
+  }
+
+  // some values read within the batch may be bogus, read them again with
+  // each access checked on its own
+  d_printf(DBG_WARN, "warning: %02x:%02x.%x: config access error, "
+                     "re-reading header\n",
+           c.addr().bus(), c.addr().dev(), c.addr().fn());
+  _read_header(c);
+}
+
+void
+Config_cache::_read_header(Config const &c)
+{
+  subsys_ids = 0;
+  cap_list = 0;
+  pm_cap = 0;
+  pcie_cap = 0;
+  pcie_type = 0;
+
   cls_rev    = c.read<l4_uint32_t>(Config::Class_rev);
   hdr_type   = c.read<l4_uint8_t>(Config::Header_type);
 
@@ -353,18 +433,46 @@ Dev::find_ext_cap(unsigned id)
 }
 
 int
-Dev::discover_bar(int bar)
+Dev::discover_bar(int bar, Enum_cache::Entry const *cached)
 {
   Cfg_bar c = config(Config::Bar_0 + bar * 4);
 
   _bars[bar] = 0;
-  l4_uint16_t cmd = disable_decoders();
-  bool valid = c.parse();
-  restore_decoders(cmd);
+
+  // the size of resizable BARs is negotiated anew on each start
+  Enum_cache::Bar const *cb = (cached && !(_rebar_bars & (1U << bar)))
+                              ? &cached->bars[bar] : nullptr;
+  bool valid;
+  if (cb && !(cb->flags & Enum_cache::Bf_valid))
+    valid = false;
+  else if (!cb
+           || !c.parse_known((cb->flags & Enum_cache::Bf_io)
+                             ? Cfg_bar::T_io : Cfg_bar::T_mmio,
+                             cb->flags & Enum_cache::Bf_64bit,
+                             cb->flags & Enum_cache::Bf_prefetch,
+                             cb->size))
+    {
+      cb = nullptr;
+      l4_uint16_t cmd = disable_decoders();
+      valid = c.parse();
+      restore_decoders(cmd);
+    }
+  else
+    valid = true;
 
   if (!valid) // skip invalid (empty) BAR
     return bar + 1;
 
+  // A BAR left unassigned by the firmware gets the address it had during the
+  // last run. If that does not fit anymore the allocation phase takes over.
+  l4_uint64_t base = c.base();
+  if (cb && !base && cb->start)
+    base = cb->start;
+
+  // The global allocation places all BARs anew.
+  if (Io_config::cfg->pci_alloc() == Io_config::Pci_alloc_global)
+    base = 0;
+
   unsigned io_flags =  Resource::Io_res
                      | Resource::F_size_aligned
                      | Resource::F_hierarchical
@@ -380,7 +488,9 @@ Dev::discover_bar(int bar)
   switch (c.type())
     {
     case Cfg_bar::T_mmio:
-      res = new Resource(mem_flags);
+      res = new_rebar_resource(bar, mem_flags);
+      if (!res)
+        res = new Resource(mem_flags);
       // set ID to 'BARx', x == bar
       res->set_id(0x00524142 + (((l4_uint32_t)('0' + bar)) << 24));
       _bars[bar] = res;
@@ -394,7 +504,7 @@ Dev::discover_bar(int bar)
       if (c.is_prefetchable())
         res->add_flags(Resource::F_prefetchable);
 
-      res->start_size(c.base(), c.size());
+      res->start_size(base, c.size());
       break;
     case Cfg_bar::T_io:
       res = new Resource(io_flags);
@@ -402,7 +512,7 @@ Dev::discover_bar(int bar)
       res->set_id(0x00524142 + (((l4_uint32_t)('0' + bar)) << 24));
 
       _bars[bar] = res;
-      res->start_size(c.base(), c.size());
+      res->start_size(base, c.size());
     }
 
   res->validate();
@@ -411,7 +521,7 @@ Dev::discover_bar(int bar)
 }
 
 void
-Dev::discover_expansion_rom()
+Dev::discover_expansion_rom(Enum_cache::Entry const *cached)
 {
   l4_uint32_t v, x;
   unsigned rom_register = (cfg.type() == 0) ? 12 * 4 : 14 * 4;
@@ -423,12 +533,25 @@ Dev::discover_expansion_rom()
   if (v == 0xffffffff)
     return; // no expansion ROM
 
-  l4_uint16_t cmd = disable_decoders();
-  c.write<l4_uint32_t>(rom_register, ~0x7ffU);
-  x = c.read<l4_uint32_t>(rom_register);
-  // write value back and disable expansion ROM
-  c.write<l4_uint32_t>(rom_register, v & ~0x1);
-  restore_decoders(cmd);
+  if (cached)
+    {
+      if (!(cached->rom.flags & Enum_cache::Bf_valid))
+        return; // no expansion ROM
+
+      // the size mask as read back by the sizing cycle
+      x = ~(l4_uint32_t)(cached->rom.size - 1);
+      if (v & 1)
+        c.write<l4_uint32_t>(rom_register, v & ~0x1);
+    }
+  else
+    {
+      l4_uint16_t cmd = disable_decoders();
+      c.write<l4_uint32_t>(rom_register, ~0x7ffU);
+      x = c.read<l4_uint32_t>(rom_register);
+      // write value back and disable expansion ROM
+      c.write<l4_uint32_t>(rom_register, v & ~0x1);
+      restore_decoders(cmd);
+    }
 
   v &= ~0x7ff;
 
@@ -483,36 +606,81 @@ void
 Dev::discover_pci_caps()
 {
   auto c = config();
+  l4_uint16_t msi_cap, msix_cap, pcie_cap;
+  l4_uint32_t pcie_dev_caps;
+
+  // only collect the capability offsets here, they are applied once the
+  // reads are known to be good
+  auto scan = [&]()
     {
+      msi_cap = msix_cap = pcie_cap = 0;
+      pcie_dev_caps = 0;
+
       l4_uint16_t status = c.read<l4_uint16_t>(Config::Status);
       if (!(status & CS_cap_list))
-        return;
-    }
+        return false;
+
+      l4_uint32_t cap_ptr = c.read<l4_uint8_t>(Config::Capability_ptr);
+      cap_ptr &= ~0x3;
+      for (; cap_ptr; cap_ptr = c.read<l4_uint8_t>(cap_ptr + 1) & ~0x3)
+        {
+          l4_uint32_t id = c.read<l4_uint8_t>(cap_ptr);
+          if (0)
+            printf("  PCI-cap: ptr: %x -> %x %s %s\n", cap_ptr, id,
+                   Io_config::cfg->transparent_msi(host()) ? "yes" : "no",
+                   system_icu()->info.supports_msi() ? "yes" : "no" );
+          switch (id)
+            {
+            case Hw::Pci::Cap::Msi:
+              msi_cap = cap_ptr;
+              break;
+            case Hw::Pci::Cap::Msi_x:
+              msix_cap = cap_ptr;
+              break;
+            case Hw::Pci::Cap::Pcie:
+              pcie_cap = cap_ptr;
+              pcie_dev_caps = c.read<l4_uint32_t>(cap_ptr + 4);
+              break;
+            default:
+              break;
+            }
+        }
+
+      return true;
+    };
+
+  bool has_caps;
+  {
+    Cfg_batch batch(c);
+    has_caps = scan();
+    if (batch.end() < 0)
+      {
+        d_printf(DBG_WARN, "warning: %s: config access error, "
+                           "re-reading capabilities\n", host()->name());
+        has_caps = scan();
+      }
+  }
 
-  l4_uint32_t cap_ptr = c.read<l4_uint8_t>(Config::Capability_ptr);
-  cap_ptr &= ~0x3;
-  for (; cap_ptr; cap_ptr = c.read<l4_uint8_t>(cap_ptr + 1) & ~0x3)
+  if (!has_caps)
+    return;
+
+  if (msi_cap)
+    _msi_cap = msi_cap;
+
+  if (msix_cap)
+    _msix_cap = msix_cap;
+
+  if (pcie_cap)
     {
-      l4_uint32_t id = c.read<l4_uint8_t>(cap_ptr);
-      if (0)
-        printf("  PCI-cap: ptr: %x -> %x %s %s\n", cap_ptr, id,
-               Io_config::cfg->transparent_msi(host()) ? "yes" : "no",
-               system_icu()->info.supports_msi() ? "yes" : "no" );
-      switch (id)
+      _phantomfn_bits = (pcie_dev_caps >> 3) & 3;
+      if (!_saved_state.find_cap(Cap::Pcie))
         {
-        case Hw::Pci::Cap::Msi:
-          parse_msi_cap(cfg_addr(cap_ptr));
-          break;
-        case Hw::Pci::Cap::Pcie:
-          {
-            l4_uint32_t v = c.read<l4_uint32_t>(cap_ptr + 4);
-            _phantomfn_bits = (v >> 3) & 3;
-            break;
-          }
-        default:
-          break;
+          add_saved_cap(new Saved_pcie_cap(pcie_cap));
+          Pcie_tuning::add_device(this);
         }
     }
+
+  setup_irq_mode();
 }
 
 void
@@ -533,12 +701,17 @@ Dev::discover_resources(Hw::Device *host)
       host->add_resource_rq(r);
     }
 
+  auto const *cached = Enum_cache::get()->lookup(segment_nr(), cfg);
+
+  // resizable BARs get their own resources, sized when allocated
+  discover_rebar();
+
   int bars = cfg.nbars();
 
   for (int bar = 0; bar < bars;)
-    bar = discover_bar(bar);
+    bar = discover_bar(bar, cached);
 
-  discover_expansion_rom();
+  discover_expansion_rom(cached);
   discover_pci_caps();
 
   Cap pcie = find_pci_cap(Cap::Pcie);
@@ -621,10 +794,21 @@ Dev::pm_restore_state(Hw::Device *)
 }
 
 bool
-Dev::match_cid(cxx::String const &_cid) const
+Cid::add(l4_uint32_t *mask, l4_uint32_t *val, l4_uint32_t m, l4_uint32_t v)
+{
+  // the same register field given twice with different values
+  if ((*val ^ v) & *mask & m)
+    return false;
+
+  *mask |= m;
+  *val |= v & m;
+  return true;
+}
+
+bool
+Cid::parse(cxx::String cid)
 {
   cxx::String const prefix("PCI/");
-  cxx::String cid(_cid);
   if (!cid.starts_with(prefix))
     return false;
 
@@ -645,12 +829,11 @@ Dev::match_cid(cxx::String const &_cid) const
 
           l4_uint32_t _csr;
           int l = tok.from_hex(&_csr);
-          if (l < 0 || l > 6 || l % 2)
+          if (l <= 0 || l > 6 || l % 2)
             return false;
 
-          if ((cfg.cls_rev >> (8 + (6-l) * 4)) == _csr)
-            continue;
-          else
+          unsigned shift = 8 + (6 - l) * 4;
+          if (!add(&cc_mask, &cc_val, ~0U << shift, _csr << shift))
             return false;
         }
       else if (tok.starts_with("REV_"))
@@ -660,7 +843,7 @@ Dev::match_cid(cxx::String const &_cid) const
           if (tok.len() != 2 || tok.from_hex(&r) != 2)
             return false;
 
-          if (r != (cfg.cls_rev & 0xff))
+          if (!add(&cc_mask, &cc_val, 0xff, r))
             return false;
         }
       else if (tok.starts_with("VEN_"))
@@ -670,7 +853,7 @@ Dev::match_cid(cxx::String const &_cid) const
           if (tok.len() != 4 || tok.from_hex(&v) != 4)
             return false;
 
-          if ((cfg.vendor_device & 0xffff) != v)
+          if (!add(&vd_mask, &vd_val, 0xffff, v))
             return false;
         }
       else if (tok.starts_with("DEV_"))
@@ -680,7 +863,7 @@ Dev::match_cid(cxx::String const &_cid) const
           if (tok.len() != 4 || tok.from_hex(&d) != 4)
             return false;
 
-          if (((cfg.vendor_device >> 16) & 0xffff) != d)
+          if (!add(&vd_mask, &vd_val, 0xffff0000, d << 16))
             return false;
         }
       else if (tok.starts_with("SUBSYS_"))
@@ -689,19 +872,21 @@ Dev::match_cid(cxx::String const &_cid) const
           tok = tok.substr(7);
           if (tok.len() != 8 || tok.from_hex(&s) != 8)
             return false;
-          if (cfg.subsys_ids != s)
+
+          if (!add(&ss_mask, &ss_val, ~0U, s))
             return false;
         }
       else if (tok.starts_with("ADR_"))
         {
           cxx::String adr = tok.substr(4);
-          l4_uint32_t segment, bus, device, function;
+          l4_uint32_t seg, b, device, function;
+          bool ok = false;
 
           for (;;)
             {
               unsigned l;
 
-              l = adr.from_hex(&segment);
+              l = adr.from_hex(&seg);
               if (l == 0)
                 break;
 
@@ -710,7 +895,7 @@ Dev::match_cid(cxx::String const &_cid) const
                 break;
 
               adr = adr.substr(1);
-              l = adr.from_hex(&bus);
+              l = adr.from_hex(&b);
               if (l == 0)
                 break;
 
@@ -732,13 +917,30 @@ Dev::match_cid(cxx::String const &_cid) const
               if (l == 0)
                 break;
 
-              return    segment == segment_nr() && bus_nr() == bus
-                     && device_nr() == device && function_nr() == function;
+              ok = true;
+              break;
             }
 
-          d_printf(DBG_ERR, "error: PCI/ADR_xxxx:xx:xx.x format error: %.*s\n",
-                   tok.len(), tok.start());
-          return false;
+          if (!ok)
+            {
+              d_printf(DBG_ERR,
+                       "error: PCI/ADR_xxxx:xx:xx.x format error: %.*s\n",
+                       tok.len(), tok.start());
+              return false;
+            }
+
+          // no function has such an address
+          if (device > 31 || function > 7)
+            return false;
+
+          unsigned df = (device << 3) | function;
+          if (has_adr && (segment != seg || bus != b || devfn != df))
+            return false;
+
+          has_adr = true;
+          segment = seg;
+          bus = b;
+          devfn = df;
         }
       else
         return false;
@@ -747,6 +949,27 @@ Dev::match_cid(cxx::String const &_cid) const
   return true;
 }
 
+bool
+Cid::match(Dev const *d) const
+{
+  Config_cache const &c = d->cfg;
+  if ((c.vendor_device & vd_mask) != vd_val
+      || (c.cls_rev & cc_mask) != cc_val
+      || (c.subsys_ids & ss_mask) != ss_val)
+    return false;
+
+  return !has_adr
+         || (d->segment_nr() == segment && d->bus_nr() == bus
+             && d->devfn() == devfn);
+}
+
+bool
+Dev::match_cid(cxx::String const &cid) const
+{
+  Cid c;
+  return c.parse(cid) && c.match(this);
+}
+
 static const char * const pci_classes[] =
 {
   /* 0x00 */ "legacy",
@@ -821,74 +1044,77 @@ Dev::dump(int indent) const
 #endif
 }
 
-Dev *
-find_pci_device(l4_uint16_t seg, l4_uint8_t bus, l4_uint8_t devnr,
-                l4_uint8_t fn)
-{
-  // start iterating at the root of the device tree to find the device with
-  // the Pci::Dev feature that matches the PCI address.
-  Hw::Device *root = system_bus();
-  Hw::Device *dev = root->children();
-  Hw::Device *peek_dev = dev;
-  bool parent_move = false;
+namespace {
 
-  d_printf(DBG_DEBUG,
-           "Start search for %04x::%02x:%x.%x at root dev: %p (name: %s, hid: "
-           "%s), child dev %p\n",
-           seg, bus, devnr, fn, root, root->name(), root->hid(), dev);
+/**
+ * Index of all PCI functions by segment, bus and devfn.
+ *
+ * The per-bus tables are allocated on demand when the first function on a
+ * bus is registered.
+ */
+class Dev_index
+{
+public:
+  struct Bus
+  {
+    Dev *fn[256] = { nullptr };
+  };
+
+  struct Segment
+  {
+    Bus *bus[256] = { nullptr };
+  };
+
+  void add(Dev *d)
+  {
+    Segment *&s = _segments[d->segment_nr()];
+    if (!s)
+      s = new Segment();
+
+    Bus *&b = s->bus[d->bus_nr() & 0xff];
+    if (!b)
+      b = new Bus();
+
+    b->fn[d->devfn() & 0xff] = d;
+  }
+
+  Dev *find(l4_uint16_t seg, l4_uint8_t bus, l4_uint8_t devfn) const
+  {
+    auto s = _segments.find(seg);
+    if (s == _segments.end())
+      return nullptr;
+
+    Bus const *b = s->second->bus[bus];
+    return b ? b->fn[devfn] : nullptr;
+  }
+
+private:
+  std::map<l4_uint16_t, Segment *> _segments;
+};
 
-  while (dev != root)
-    {
-      d_printf(DBG_DEBUG,
-               "> Step: current dev %p (name: %s, hid: %s), parent_move %i\n",
-               dev, dev->name(), dev->hid(), parent_move);
-      if (parent_move)
-        {
-          // parent already checked
-          peek_dev = dev->next();
-          if (!peek_dev)
-            {
-              dev = dev->parent();
-              continue; // skip check and back up
-            }
-          else
-            {
-              parent_move = false;
-              dev = peek_dev;
-            }
-        }
+static Dev_index &dev_index()
+{
+  static Dev_index idx;
+  return idx;
+}
 
-      // do check
-      Hw::Pci::Dev *pdev = dev->find_feature<Hw::Pci::Dev>();
-      if (pdev != nullptr)
-        {
-          if (pdev->segment_nr() == seg && pdev->bus_nr() == bus
-              && pdev->device_nr() == devnr && pdev->function_nr() == fn)
-            {
-              d_printf(DBG_DEBUG, "\tPCI Dev found for %04x::%02x:%x.%x: %p\n",
-                     pdev->segment_nr(), bus, devnr, fn, pdev);
-              return pdev;
-            }
-          else
-            d_printf(DBG_DEBUG, "\tPCI dev is: %04x::%02x:%x.%x\n",
-                     pdev->segment_nr(), pdev->bus_nr(), pdev->device_nr(),
-                     pdev->function_nr());
-        }
+}
 
-      peek_dev = dev->children();
-      if (!peek_dev)
-        // no children
-        peek_dev = dev->next();
-      if (!peek_dev)
-        {
-          // no children and no sibling
-          peek_dev = dev->parent();
-          parent_move = true;
-        }
-      dev = peek_dev;
-    }
+void
+register_pci_device(Dev *dev)
+{
+  dev_index().add(dev);
+}
 
-  return nullptr;
+Dev *
+find_pci_device(l4_uint16_t seg, l4_uint8_t bus, l4_uint8_t devnr,
+                l4_uint8_t fn)
+{
+  Dev *d = dev_index().find(seg, bus, ((devnr & 0x1f) << 3) | (fn & 0x7));
+  if (!d)
+    d_printf(DBG_DEBUG, "No PCI device registered for %04x:%02x:%x.%x\n",
+             seg, bus, devnr, fn);
+  return d;
 }
 
 } }
@@ -8,6 +8,15 @@
 
 #include <pci-driver.h>
 
+#include "debug.h"
+#include "hw_async_init.h"
+#include "hw_device.h"
+#include "timing_stats.h"
+#include "worker_pool.h"
+
+#include <map>
+#include <vector>
+
 namespace Hw { namespace Pci {
 namespace {
 
@@ -25,6 +34,77 @@ static Drv_list &driver_for_class()
   return l;
 }
 
+void
+timed_probe(Driver *drv, Dev *d)
+{
+  Hw::Device *host = d->host();
+  l4_uint64_t start = Timing_stats::now_us();
+  drv->probe(d);
+  l4_uint64_t t = Timing_stats::now_us() - start;
+  if (dlevel(DBG_DEBUG))
+    d_printf(DBG_DEBUG, "%s: probed by %s in %llu us\n",
+             host->get_full_path().c_str(), drv->name(),
+             (unsigned long long)t);
+  Timing_stats::record_startup_step(L4VBUS_STARTUP_PROBE, start,
+    [host, drv]{ return host->get_full_path() + ":" + drv->name(); });
+}
+
+/**
+ * A queued asynchronous probe.
+ *
+ * Runs after the probe of `parent`, the probe of the nearest parent device
+ * that was still queued when this one was queued.
+ */
+struct Probe_job : Worker_pool::Job
+{
+  Driver *drv;
+  Dev *dev;
+  Probe_job *parent;
+
+  Probe_job(Driver *drv, Dev *dev, Probe_job *parent)
+  : drv(drv), dev(dev), parent(parent)
+  {}
+
+  void run() override
+  {
+    if (parent)
+      Worker_pool::wait(parent);
+
+    timed_probe(drv, dev);
+  }
+};
+
+// the queued probes, only used by the main thread
+std::vector<Probe_job *> &async_probes()
+{
+  static std::vector<Probe_job *> l;
+  return l;
+}
+
+std::map<Hw::Device *, Probe_job *> &async_probe_of()
+{
+  static std::map<Hw::Device *, Probe_job *> m;
+  return m;
+}
+
+/// The queued probe of the nearest parent device of `host`, if any.
+Probe_job *
+parent_probe(Hw::Device *host)
+{
+  auto const &m = async_probe_of();
+  if (m.empty())
+    return nullptr;
+
+  for (Hw::Device *p = host->parent(); p; p = p->parent())
+    {
+      auto i = m.find(p);
+      if (i != m.end())
+        return i->second;
+    }
+
+  return nullptr;
+}
+
 }
 
 bool
@@ -62,4 +142,44 @@ Driver::find(Dev *dev)
   return 0;
 }
 
+void
+Driver::probe_dev(Dev *dev)
+{
+  Driver *drv = find(dev);
+  if (!drv)
+    return;
+
+  Probe_job *parent = parent_probe(dev->host());
+  unsigned workers = Hw::Async_init::workers();
+  if (!drv->async_probe() || !workers)
+    {
+      if (parent)
+        Worker_pool::wait(parent);
+
+      timed_probe(drv, dev);
+      return;
+    }
+
+  Probe_job *job = new Probe_job(drv, dev, parent);
+  async_probes().push_back(job);
+  async_probe_of()[dev->host()] = job;
+
+  Worker_pool::reserve(workers);
+  Worker_pool::submit(job);
+}
+
+void
+Driver::wait_async_probes()
+{
+  // in queuing order, so each parent probe is waited for before its children
+  for (Probe_job *job: async_probes())
+    Worker_pool::wait(job);
+
+  for (Probe_job *job: async_probes())
+    delete job;
+
+  async_probes().clear();
+  async_probe_of().clear();
+}
+
 }}
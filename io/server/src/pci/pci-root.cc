@@ -9,10 +9,11 @@
 #include <pci-root.h>
 #include <vector>
 
+#include <utils.h>
+
 #if defined(ARCH_x86) || defined(ARCH_amd64)
 
 #include <l4/util/port_io.h>
-#include <utils.h>
 
 #endif
 
@@ -60,14 +61,48 @@ Port_root_bridge::cfg_write(Cfg_addr addr, l4_uint32_t value, Cfg_width w)
 
 #endif
 
+static pthread_mutex_t mmio_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+l4_addr_t
+Mmio_root_bridge::map_bus(unsigned bus)
+{
+  if (bus < _first_bus || bus >= _first_bus + _num_busses)
+    return 0;
+
+  Pthread_mutex_guard g(&mmio_map_lock);
+  if (_bus_mmio[bus])
+    return _bus_mmio[bus];
+
+  l4_addr_t m = res_map_iomem(_phys_base + (l4_uint64_t{bus} << Bus_shift),
+                              1UL << Bus_shift);
+  if (!m)
+    {
+      d_printf(DBG_ERR, "error: cannot map ECAM window of bus %04x:%02x\n",
+               segment(), bus);
+      return 0;
+    }
+
+  d_printf(DBG_DEBUG2, "PCI: mapped ECAM window of bus %04x:%02x\n",
+           segment(), bus);
+  _bus_mmio[bus] = m;
+  return m;
+}
+
 int
 Mmio_root_bridge::cfg_read(Cfg_addr addr, l4_uint32_t *value, Cfg_width w)
 {
+  l4_addr_t r = a(addr);
+  if (!r)
+    {
+      *value = ~0U;
+      return -L4_ENODEV;
+    }
+
   switch (w)
     {
-    case Cfg_byte:  *value = *(volatile l4_uint8_t  *)a(addr); break;
-    case Cfg_short: *value = *(volatile l4_uint16_t *)a(addr); break;
-    case Cfg_long:  *value = *(volatile l4_uint32_t *)a(addr); break;
+    case Cfg_byte:  *value = *(volatile l4_uint8_t  *)r; break;
+    case Cfg_short: *value = *(volatile l4_uint16_t *)r; break;
+    case Cfg_long:  *value = *(volatile l4_uint32_t *)r; break;
     }
   return 0;
 }
@@ -75,11 +110,15 @@ Mmio_root_bridge::cfg_read(Cfg_addr addr, l4_uint32_t *value, Cfg_width w)
 int
 Mmio_root_bridge::cfg_write(Cfg_addr addr, l4_uint32_t value, Cfg_width w)
 {
+  l4_addr_t r = a(addr);
+  if (!r)
+    return -L4_ENODEV;
+
   switch (w)
     {
-    case Cfg_byte:  *(volatile l4_uint8_t  *)a(addr) = value; break;
-    case Cfg_short: *(volatile l4_uint16_t *)a(addr) = value; break;
-    case Cfg_long:  *(volatile l4_uint32_t *)a(addr) = value; break;
+    case Cfg_byte:  *(volatile l4_uint8_t  *)r = value; break;
+    case Cfg_short: *(volatile l4_uint16_t *)r = value; break;
+    case Cfg_long:  *(volatile l4_uint32_t *)r = value; break;
     }
 
   return 0;
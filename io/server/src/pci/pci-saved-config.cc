@@ -7,6 +7,8 @@
  */
 
 #include <pci-saved-config.h>
+#include <pci-caps.h>
+#include "debug.h"
 
 // there is some stray l4_sleep in the code used during config space restore
 #include <l4/util/util.h>
@@ -27,11 +29,24 @@ void
 Saved_config::save(If *dev)
 {
   auto cfg = dev->config();
-  for (unsigned i = 0; i < 16; ++i)
-    cfg.read(i * 4, &_regs.w[i]);
-
-  for (auto c = _caps.begin(); c != _caps.end(); ++c)
-    c->save(cfg);
+  auto save_all = [this, cfg]()
+    {
+      cfg.read_block(0, _regs.w, 16);
+      for (auto c = _caps.begin(); c != _caps.end(); ++c)
+        c->save(cfg);
+    };
+
+  {
+    Cfg_batch batch(cfg);
+    save_all();
+    if (batch.end() == 0)
+      return;
+  }
+
+  // do not keep possibly bogus values for the next restore
+  d_printf(DBG_WARN, "warning: %s: config access error, saving again\n",
+           dev->host()->name());
+  save_all();
 }
 
 static void
@@ -42,18 +57,23 @@ restore_cfg_word(Config cfg, l4_uint32_t value, int retry)
   if (v == value)
     return;
 
-  for (;;)
+  // `retry` is the number of 1 ms back-offs the device gets. Poll in steps
+  // of 100 us within the same total time, as devices are restored
+  // concurrently and a millisecond per retry adds up over a full resume.
+  int polls = retry * 10;
+  for (bool first = true;; first = false)
     {
       cfg.write(0, value);
-      if (retry-- <= 0)
+      if (polls-- <= 0)
         return;
 
       cfg.read(0, &v);
       if (v == value)
         return;
 
-      // MUAHHHH:
-      l4_sleep(1);
+      // most devices accept the value on the second attempt
+      if (!first)
+        l4_usleep(100);
     }
 }
 
@@ -69,26 +89,45 @@ void
 Saved_config::restore(If *dev)
 {
   Saved_cap *pcie = find_cap(Cap::Pcie);
+  Saved_cap *rebar = find_cap(Resizable_bar_cap::Id);
 
   auto cfg = dev->config();
-
-  // PCI express state must be restored first
-  if (pcie)
-    pcie->restore(cfg);
-
-  if ((read<l4_uint8_t>(Config::Header_type) & 0x7f) == 0)
+  auto restore_all = [&]()
     {
-      restore_cfg_range(cfg, _regs.w, 10, 15);
-      restore_cfg_range(cfg, _regs.w, 4, 9, 10); //< BARs
-      restore_cfg_range(cfg, _regs.w, 0, 3);     //< command and status etc.
-    }
-  else
-    // we do a dumb restore for bridges
-    restore_cfg_range(cfg, _regs.w, 0, 15);
-
-  for (auto c = _caps.begin(); c != _caps.end(); ++c)
-    if (c->type() != Cap::Pcie) // skip the PCI express state (already restored)
-      c->restore(cfg);
+      // PCI express state must be restored first
+      if (pcie)
+        pcie->restore(cfg);
+
+      // the BAR sizes must be set before the BAR addresses
+      if (rebar)
+        rebar->restore(cfg);
+
+      if ((read<l4_uint8_t>(Config::Header_type) & 0x7f) == 0)
+        {
+          restore_cfg_range(cfg, _regs.w, 10, 15);
+          restore_cfg_range(cfg, _regs.w, 4, 9, 10); //< BARs
+          restore_cfg_range(cfg, _regs.w, 0, 3);     //< command and status etc.
+        }
+      else
+        // we do a dumb restore for bridges
+        restore_cfg_range(cfg, _regs.w, 0, 15);
+
+      for (auto c = _caps.begin(); c != _caps.end(); ++c)
+        if (*c != pcie && *c != rebar) // already restored
+          c->restore(cfg);
+    };
+
+  {
+    Cfg_batch batch(cfg);
+    restore_all();
+    if (batch.end() == 0)
+      return;
+  }
+
+  // writes of the batch may have been lost, restoring is idempotent
+  d_printf(DBG_WARN, "warning: %s: config access error, restoring again\n",
+           dev->host()->name());
+  restore_all();
 }
 
 }}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include <pci-dev.h>
+#include <pci-caps.h>
+
+#include "debug.h"
+#include "hw_device.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace Hw { namespace Pci {
+
+namespace {
+
+typedef Resizable_bar_cap Rebar;
+
+class Saved_rebar_cap : public Saved_cap
+{
+public:
+  Saved_rebar_cap(unsigned offset, unsigned num)
+  : Saved_cap(Rebar::Id, offset), _num(num)
+  {}
+
+private:
+  unsigned _num;
+  l4_uint32_t _ctrl[6];
+
+  void _save(Config cap) override
+  {
+    for (unsigned i = 0; i < _num; ++i)
+      cap.read(Rebar::bar_ctrl_ofs(i), &_ctrl[i]);
+  }
+
+  void _restore(Config cap) override
+  {
+    // only the size field is writable, the BARs themselves are restored
+    // afterwards with the addresses matching the restored sizes
+    for (unsigned i = 0; i < _num; ++i)
+      cap.write(Rebar::bar_ctrl_ofs(i), _ctrl[i]);
+  }
+};
+
+/**
+ * Lua knob for the size of the resizable BARs of a device.
+ *
+ * `set(-1, size)` applies to all resizable BARs of the device, `set(n, size)`
+ * only to BAR n.
+ */
+class Rebar_size_property : public Int_property
+{
+public:
+  explicit Rebar_size_property(Dev *dev) : _dev(dev) {}
+
+  using Int_property::set;
+  int set(int k, l4_int64_t size) override
+  {
+    if (size <= 0)
+      return -EINVAL;
+
+    int r = _dev->set_rebar_size(k, size);
+    if (r < 0)
+      return r;
+
+    return Int_property::set(-1, size);
+  }
+
+private:
+  Dev *_dev;
+};
+
+/**
+ * Pick the size encoding for a resizable BAR.
+ *
+ * \return The encoding of the largest supported size not exceeding `limit`,
+ *         or of the smallest supported size if none is small enough.
+ */
+int
+pick_size(l4_uint64_t sizes, l4_uint64_t limit)
+{
+  int enc = -1;
+  for (unsigned i = 0; i < 64; ++i)
+    if (sizes & (l4_uint64_t{1} << i))
+      {
+        if (enc < 0 || Rebar::size_bytes(i) <= limit)
+          enc = i;
+        if (Rebar::size_bytes(i) > limit)
+          break;
+      }
+  return enc;
+}
+
+/// Whether `r` is placed in one of `windows`, directly or via bridge windows.
+bool
+placed_in(Resource const *r, std::vector<Resource *> const &windows)
+{
+  for (Resource const *p = r->parent(); p; p = p->parent())
+    if (std::find(windows.begin(), windows.end(), p) != windows.end())
+      return true;
+
+  return false;
+}
+
+/**
+ * Get the space the resources below `top` still need from `windows`.
+ *
+ * Counts the BARs not placed in the windows yet, including those already
+ * assigned to bridge windows that are sized from their children. The bridge
+ * windows themselves are not counted, their size stems from those BARs.
+ */
+l4_uint64_t
+pending_space(Resource *bar, ::Device *top,
+              std::vector<Resource *> const &windows)
+{
+  l4_uint64_t space = 0;
+  for (auto d = top->begin(L4VBUS_MAX_DEPTH); d != top->end(); ++d)
+    for (Resource *r: *d->resources())
+      {
+        if (!r || r == bar || r->disabled() || r->empty() || r->provided())
+          continue;
+
+        bool fits = false;
+        for (Resource *w: windows)
+          fits = fits || w->compatible(r, true) || w->compatible(r, false);
+
+        if (!fits || placed_in(r, windows))
+          continue;
+
+        space += cxx::max<l4_uint64_t>(r->size(), r->alignment() + 1);
+      }
+
+  return space;
+}
+
+/**
+ * Get the size budget of a memory BAR allocated from the windows of `dev`.
+ *
+ * Windows not allocated yet are sized from their children, see
+ * Device::alloc_child_resource(). For those the limit stems from the first
+ * allocated windows upstream, usually the aperture of the host bridge. The
+ * BAR gets the largest free block of those windows, less the space the other
+ * pending resources below them need.
+ *
+ * \return The budget in bytes, 0 if the windows cannot tell or if there is
+ *         no space left beyond the other pending resources.
+ */
+l4_uint64_t
+alloc_limit(Resource *bar, ::Device *dev)
+{
+  for (; dev; dev = dev->parent())
+    {
+      bool grows = false;
+      l4_uint64_t limit = 0;
+      std::vector<Resource *> windows;
+      for (Resource *w: *dev->resources())
+        {
+          if (!w || w->disabled() || !w->provided())
+            continue;
+
+          // prefetchable BARs also fit into non-prefetchable windows
+          if (!w->compatible(bar, true) && !w->compatible(bar, false))
+            continue;
+
+          if (dev->parent() && !dev->parent()->can_alloc_from_res(w))
+            continue;
+
+          windows.push_back(w);
+          if (dev->parent() && !dev->parent()->resource_allocated(w))
+            grows = true;
+          else
+            limit = cxx::max(limit, w->provided()->max_alloc_block(w));
+        }
+
+      if (windows.empty() || grows)
+        continue;
+
+      l4_uint64_t pending = pending_space(bar, dev, windows);
+      return limit > pending ? limit - pending : 0;
+    }
+
+  return 0;
+}
+
+/**
+ * Memory BAR with a size chosen when it is allocated.
+ */
+class Rebar_resource : public Resource
+{
+public:
+  Rebar_resource(Dev *dev, unsigned bar, unsigned long flags)
+  : Resource(flags), _dev(dev), _bar(bar)
+  {}
+
+  void fit_alloc(::Device *parent) override
+  {
+    _power_on_size = size();
+    _dev->resize_rebar(_bar, this, alloc_limit(this, parent));
+  }
+
+  bool shrink_alloc() override
+  {
+    // first fall back to the size the device came up with, then go below
+    l4_uint64_t s = size();
+    if (_power_on_size && s > _power_on_size)
+      return _dev->resize_rebar(_bar, this, _power_on_size);
+
+    return s > 1 && _dev->resize_rebar(_bar, this, s - 1);
+  }
+
+private:
+  Dev *_dev;
+  unsigned _bar;
+  l4_uint64_t _power_on_size = 0;
+};
+
+}
+
+void
+Dev::discover_rebar()
+{
+  Extended_cap cap = find_ext_cap(Rebar::Id);
+  if (!cap.is_valid())
+    return;
+
+  auto c = config();
+  unsigned num = cap.read<Rebar::Bar_ctrl_0>().num_bars();
+  if (num > 6)
+    num = 6;
+
+  for (unsigned i = 0; i < num; ++i)
+    {
+      auto ctrl = cap.read<Rebar::Bar_ctrl>(Rebar::bar_ctrl_ofs(i));
+      unsigned bar = ctrl.index();
+      if (bar >= 6)
+        continue;
+
+      l4_uint32_t v = c.read<l4_uint32_t>(Config::Bar_0 + bar * 4);
+      if (v & 1) // I/O BARs cannot be resized
+        continue;
+
+      // the size is chosen when the BAR is allocated, see Rebar_resource
+      _rebar_bars |= 1U << bar;
+    }
+
+  if (!_rebar_bars)
+    return;
+
+  _rebar_cap = cap.reg();
+  add_saved_cap(new Saved_rebar_cap(_rebar_cap, num));
+  _host->register_property("rebar_size", new Rebar_size_property(this));
+}
+
+Resource *
+Dev::new_rebar_resource(unsigned bar, unsigned long flags)
+{
+  if (!(_rebar_bars & (1U << bar)))
+    return nullptr;
+
+  return new Rebar_resource(this, bar, flags);
+}
+
+bool
+Dev::resize_rebar(unsigned bar, Resource *res, l4_uint64_t limit)
+{
+  if (!limit)
+    return false; // keep the size the device came up with
+
+  if (!res->is_64bit() && limit > (l4_uint64_t{1} << 31))
+    limit = l4_uint64_t{1} << 31;
+
+  Extended_cap cap = config(_rebar_cap);
+  unsigned num = cap.read<Rebar::Bar_ctrl_0>().num_bars();
+  for (unsigned i = 0; i < num && i < 6; ++i)
+    {
+      auto bcap = cap.read<Rebar::Bar_cap>(Rebar::bar_cap_ofs(i));
+      auto ctrl = cap.read<Rebar::Bar_ctrl>(Rebar::bar_ctrl_ofs(i));
+      if (ctrl.index() != bar)
+        continue;
+
+      int enc = pick_size(Rebar::supported_sizes(bcap, ctrl), limit);
+      if (enc < 0 || unsigned(enc) == ctrl.size())
+        return false;
+
+      // the BAR address is written after the allocation
+      l4_uint16_t cmd = disable_decoders();
+      ctrl.size() = enc;
+      cap.write(Rebar::bar_ctrl_ofs(i), ctrl);
+      restore_decoders(cmd);
+
+      res->size(Rebar::size_bytes(enc));
+      d_printf(DBG_INFO, "%02x:%02x.%x: resized BAR%u to %llu MiB\n",
+               bus_nr(), device_nr(), function_nr(), bar,
+               Rebar::size_bytes(enc) >> 20);
+      return true;
+    }
+
+  return false;
+}
+
+int
+Dev::set_rebar_size(int bar, l4_uint64_t size)
+{
+  if (!_rebar_cap)
+    return -L4_ENODEV;
+
+  if (bar >= 6 || (bar >= 0 && !(_rebar_bars & (1U << bar))))
+    return -L4_EINVAL;
+
+  // clients already know the BAR sizes of an assigned device
+  if (_host->ref_count())
+    return -L4_EBUSY;
+
+  Extended_cap cap = config(_rebar_cap);
+  auto c = config();
+  unsigned num = cap.read<Rebar::Bar_ctrl_0>().num_bars();
+  int res = 0;
+
+  for (unsigned i = 0; i < num && i < 6; ++i)
+    {
+      auto bcap = cap.read<Rebar::Bar_cap>(Rebar::bar_cap_ofs(i));
+      auto ctrl = cap.read<Rebar::Bar_ctrl>(Rebar::bar_ctrl_ofs(i));
+      unsigned idx = ctrl.index();
+      if (!(_rebar_bars & (1U << idx)) || (bar >= 0 && unsigned(bar) != idx))
+        continue;
+
+      Resource *r = _bars[idx];
+      if (!r)
+        continue;
+
+      int enc = pick_size(Rebar::supported_sizes(bcap, ctrl), size);
+      if (enc < 0 || unsigned(enc) == ctrl.size())
+        continue;
+
+      // The BAR was placed at its negotiated size, which is the largest one
+      // fitting the bridge windows. Shrinking it keeps the placement valid,
+      // growing it would need a new allocation.
+      l4_uint64_t new_size = Rebar::size_bytes(enc);
+      if (new_size > r->size())
+        {
+          d_printf(DBG_WARN, "warning: %02x:%02x.%x: cannot grow allocated "
+                             "BAR%u to %llu MiB\n",
+                   bus_nr(), device_nr(), function_nr(), idx, new_size >> 20);
+          res = -L4_ENOSPC;
+          continue;
+        }
+
+      unsigned reg = Config::Bar_0 + idx * 4;
+      l4_uint16_t cmd = disable_decoders();
+      ctrl.size() = enc;
+      cap.write(Rebar::bar_ctrl_ofs(i), ctrl);
+      // resizing may clear the address bits, write the BAR again
+      c.write<l4_uint32_t>(reg, r->start());
+      if (r->is_64bit())
+        c.write<l4_uint32_t>(reg + 4, r->start() >> 32);
+      restore_decoders(cmd);
+
+      r->size(new_size);
+      d_printf(DBG_INFO, "%02x:%02x.%x: resized BAR%u to %llu MiB\n",
+               bus_nr(), device_nr(), function_nr(), idx, new_size >> 20);
+    }
+
+  return res;
+}
+
+}}
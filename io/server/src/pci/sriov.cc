@@ -7,14 +7,47 @@
  */
 
 #include <pci-dev.h>
+#include <pci-bridge.h>
+#include <pci-root.h>
 #include <pci-sriov.h>
 #include <resource_provider.h>
 
+#include "cfg.h"
+
 #include <cstdio>
 #include <unistd.h>
 
 namespace Hw { namespace Pci {
 
+namespace {
+
+/**
+ * Number of VFs of a PF, setting it creates the VFs up to that number.
+ */
+class Num_vfs_property : public Int_property
+{
+public:
+  explicit Num_vfs_property(Sr_iov_feature *sriov) : _sriov(sriov) {}
+
+  using Int_property::set;
+  int set(int k, l4_int64_t num) override
+  {
+    if (k != -1 || num < 0 || num > 0xffff)
+      return -EINVAL;
+
+    int r = _sriov->create_vfs(num);
+    if (r < 0)
+      return r;
+
+    return Int_property::set(-1, num);
+  }
+
+private:
+  Sr_iov_feature *_sriov;
+};
+
+}
+
 Sr_iov_feature::Sr_iov_feature(Dev *dev, l4_uint16_t cap_ofs)
 : _dev(dev), _cap_ofs(cap_ofs)
 {
@@ -67,13 +100,11 @@ Sr_iov_feature::Sr_iov_feature(Dev *dev, l4_uint16_t cap_ofs)
 
   init_system_page_size();
 
+  // Leaves NumVFs at the maximum possible number of VFs. From now on, NumVFs
+  // must not be changed as we rely on VF Offset and VF Stride to remain stable.
   if (!discover_num_vfs())
     return;
 
-  // Use the maximum possible number of VFs. From now on, NumVFs must not be
-  // changed as we rely on VF Offset and VF Stride to remain stable.
-  set_num_vfs(_total_vfs.v);
-
   discover_vbars();
 }
 
@@ -124,11 +155,88 @@ Sr_iov_feature::init_system_page_size()
            cap.read<Sr_iov_cap::System_ps>().v);
 }
 
+unsigned
+Sr_iov_feature::vf_bus_limit() const
+{
+  auto *br = dynamic_cast<Bridge_base *>(_dev->bridge());
+  if (!br)
+    return _dev->bus_nr();
+
+  // New bus numbers are always handed out above the highest one in use, so
+  // the range of the PF's bridge can only be extended if it ends there, up
+  // to the last bus the config space access of the root bridge reaches,
+  // e.g. the end of its ECAM window.
+  Bridge_if *top = _dev->bridge();
+  while (top->parent_bridge())
+    top = top->parent_bridge();
+
+  auto *root = dynamic_cast<Root_bridge *>(top);
+  if (root && root->subordinate == br->subordinate)
+    return cxx::max<unsigned>(root->last_bus(), br->subordinate);
+
+  return br->subordinate;
+}
+
+l4_uint16_t
+Sr_iov_feature::reachable_vfs(l4_uint16_t num_vfs, char const **reason) const
+{
+  l4_uint32_t pf_rid = (_dev->bus_nr() << 8) | _dev->devfn();
+  l4_uint32_t first = pf_rid + _vf_offset.v;
+  l4_uint32_t stride = _vf_stride.v;
+  l4_uint32_t last_rid = (vf_bus_limit() << 8) | 0xff;
+
+  // The routing IDs of the VFs are first + i * stride, they must not exceed
+  // the last bus number we can provide.
+  if (!num_vfs || first > last_rid)
+    return 0;
+
+  if (num_vfs > 1 && !stride)
+    return 1;
+
+  l4_uint16_t fit = num_vfs;
+  if (stride && (last_rid - first) / stride + 1 < fit)
+    {
+      fit = (last_rid - first) / stride + 1;
+      *reason = "bus resources limited";
+    }
+
+  // Without ARI the PF's bridge forwards configuration requests for the PF's
+  // own bus to device 0 only.
+  if (!_ari_capable && (first >> 8) == (pf_rid >> 8))
+    {
+      l4_uint32_t last_fn = pf_rid | 0x7;
+      if (first > last_fn)
+        return 0;
+
+      if (stride && (last_fn - first) / stride + 1 < fit)
+        {
+          fit = (last_fn - first) / stride + 1;
+          *reason = "bus resources limited - no ARI";
+        }
+    }
+
+  return fit;
+}
+
+bool
+Sr_iov_feature::reserve_vf_buses(unsigned last_bus)
+{
+  auto *br = dynamic_cast<Bridge_base *>(_dev->bridge());
+  if (!br)
+    return last_bus == _dev->bus_nr();
+
+  while (br->subordinate < last_bus)
+    if (!_dev->bridge()->alloc_bus_number())
+      return false;
+
+  return true;
+}
+
 bool
 Sr_iov_feature::discover_num_vfs()
 {
   l4_uint16_t max_vfs = _total_vfs.v;
-  char const *limit_reason;
+  char const *limit_reason = nullptr;
 
   // Limit maximum number of VFs to the configured value.
   if (max_vfs > Max_vfs)
@@ -137,29 +245,35 @@ Sr_iov_feature::discover_num_vfs()
       limit_reason = "hardcoded";
     }
 
-  // Determine maximum number of VFs we can enable.
-  l4_uint32_t pf_addr = _dev->cfg_addr().devfn();
-  for (l4_uint16_t num_vfs = 1; num_vfs < max_vfs; num_vfs++)
+  // VF Offset and VF Stride may change with NumVFs, so they are read back for
+  // the candidate number of VFs and the number of VFs with a reachable routing
+  // ID is computed from them. Only if that is lower, the check is repeated
+  // with the lower number, which usually settles after one or two rounds.
+  while (max_vfs)
     {
-      set_num_vfs(num_vfs);
+      set_num_vfs(max_vfs);
+      l4_uint16_t fit = reachable_vfs(max_vfs, &limit_reason);
+      if (fit >= max_vfs)
+        break;
+
+      max_vfs = fit;
+    }
 
-      l4_uint32_t first_vf_addr = pf_addr + _vf_offset.v;
-      l4_uint32_t last_vf_addr = first_vf_addr + num_vfs * _vf_stride.v;
-      // We currently do not support allocating multiple bus numbers for a
-      // SR-IOV device, so check that all VFs are on the same bus as the PF.
-      // This limits the number of VFs we can support to 255 with ARI enabled,
-      // or 7 when ARI is not supported.
-      l4_uint32_t Bus_mask = _ari_capable ? ~0xffU : ~0x7U;
-      if (   (first_vf_addr & Bus_mask) != (pf_addr & Bus_mask)
-          || (last_vf_addr & Bus_mask) != (pf_addr & Bus_mask))
+  if (max_vfs > 0)
+    {
+      l4_uint32_t pf_rid = (_dev->bus_nr() << 8) | _dev->devfn();
+      l4_uint32_t last_rid = pf_rid + _vf_offset.v
+                             + (max_vfs - 1) * _vf_stride.v;
+      unsigned last_bus = last_rid >> 8;
+      if (!reserve_vf_buses(last_bus))
         {
-          // VF on different bus than PF, so the num_vfs from the previous
-          // iteration is the maximum we can support.
-          max_vfs = num_vfs - 1;
-          limit_reason = _ari_capable ? "bus resources limited"
-                                      : "bus resources limited - no ARI";
-          break;
+          d_printf(DBG_WARN, "SR-IOV: could not reserve buses %02x-%02x\n",
+                   _dev->bus_nr() + 1, last_bus);
+          max_vfs = 0;
         }
+      else if (last_bus != _dev->bus_nr())
+        d_printf(DBG_INFO, "SR-IOV: VFs use buses %02x-%02x\n",
+                 _dev->bus_nr(), last_bus);
     }
 
   if (max_vfs == 0)
@@ -224,7 +338,7 @@ Sr_iov_feature::discover_vbars()
     }
 }
 
-void
+Hw::Device *
 Sr_iov_feature::init_vf(unsigned vf_idx, Sr_iov_cap::Vf_device_id vf_dev_id)
 {
   // Calculate address of given VF relative to PF.
@@ -247,10 +361,17 @@ Sr_iov_feature::init_vf(unsigned vf_idx, Sr_iov_cap::Vf_device_id vf_dev_id)
   // bridge as the PF. However, the MMIO resources are placed as child resources
   // of the PF VBAR resources.
 
-  Hw::Device *vf_dev = new Hw::Device(cfg.addr().devfn());
+  // VFs beyond the bus of the PF get the bus number into their address to
+  // keep it unique among the siblings.
+  l4_uint32_t adr = cfg.addr().devfn();
+  if (cfg.addr().bus() != _dev->bus_nr())
+    adr |= cfg.addr().bus() << 8;
+
+  Hw::Device *vf_dev = new Hw::Device(adr);
   Sr_iov_vf *vf = new Sr_iov_vf(vf_dev, _dev->bridge(), cfg);
   vf_dev->add_feature(vf);
   _dev->host()->parent()->add_child(vf_dev);
+  register_pci_device(vf);
 
   for (unsigned bar_idx = 0; bar_idx < 6; ++bar_idx)
   {
@@ -281,10 +402,11 @@ Sr_iov_feature::init_vf(unsigned vf_idx, Sr_iov_cap::Vf_device_id vf_dev_id)
   }
 
   vf->discover_resources(vf_dev);
+  return vf_dev;
 }
 
 void
-Sr_iov_feature::setup(Hw::Device *)
+Sr_iov_feature::setup(Hw::Device *host)
 {
   d_printf(DBG_INFO, "setup SR-IOV device\n");
   if (_total_vfs.v == 0)
@@ -296,6 +418,36 @@ Sr_iov_feature::setup(Hw::Device *)
   if (!setup_vbars())
     return;
 
+  _vbars_ready = true;
+  host->register_property("num_vfs", new Num_vfs_property(this));
+
+  if (Io_config::cfg->sriov_lazy_vfs(host))
+    {
+      d_printf(DBG_INFO, "SR-IOV: VFs are created on demand (max %u)\n",
+               _total_vfs.v);
+      return;
+    }
+
+  create_vfs(_total_vfs.v);
+}
+
+bool
+Sr_iov_feature::enable_vfs(l4_uint16_t num_vfs)
+{
+  if (num_vfs != _num_vfs.v)
+    {
+      // The bus numbers were reserved for the maximum number of VFs, check
+      // that the layout for the lower number still fits into them.
+      set_num_vfs(num_vfs);
+      char const *reason = nullptr;
+      if (reachable_vfs(num_vfs, &reason) < num_vfs)
+        {
+          d_printf(DBG_ERR, "error: SR-IOV: %u VFs not reachable (%s)\n",
+                   num_vfs, reason);
+          return false;
+        }
+    }
+
   auto ctrl = cap().read<Sr_iov_cap::Ctrl>();
   ctrl.vf_enable() = 1;
   ctrl.vf_memory_enable() = 1;
@@ -311,14 +463,50 @@ Sr_iov_feature::setup(Hw::Device *)
   // Express Base Specification Revision 5.0").
   l4_ipc_sleep_ms(100);
 
+  _vf_dev_id = cap().read<Sr_iov_cap::Vf_device_id>();
+  _enabled = true;
+  d_printf(DBG_INFO, "SR-IOV enabled (%u VFs)...\n", num_vfs);
+  return true;
+}
+
+int
+Sr_iov_feature::create_vfs(unsigned num)
+{
+  if (!_vbars_ready)
+    return -L4_ENODEV;
+
+  if (num > _total_vfs.v)
+    return -L4_ERANGE;
+
+  if (num <= _num_created)
+    return 0;
+
+  // NumVFs must not change while VFs are enabled.
+  if (!_enabled)
+    {
+      if (!enable_vfs(num))
+        return -L4_EIO;
+    }
+  else if (num > _num_vfs.v)
+    {
+      d_printf(DBG_WARN, "SR-IOV: VFs already enabled with NumVFs=%u\n",
+               _num_vfs.v);
+      return -L4_EBUSY;
+    }
+
   // We can only initialize the VF devices now, after the PF set VF enable,
   // since only then the VF devices are realized by hardware.
-  auto vf_dev_id = cap().read<Sr_iov_cap::Vf_device_id>();
-  for (unsigned i = 0; i < _total_vfs.v; ++i)
-    init_vf(i, vf_dev_id);
+  for (; _num_created < num; ++_num_created)
+    {
+      Hw::Device *vf = init_vf(_num_created, _vf_dev_id);
 
-  _enabled = true;
-  d_printf(DBG_INFO, "SR-IOV enabled...\n");
+      // VFs created during the setup of the PF are initialized together with
+      // the other devices on the PF's bus, later ones have to be plugged here.
+      if (_dev->host()->pm_is_online())
+        vf->plugin();
+    }
+
+  return 0;
 }
 
 bool
@@ -352,9 +540,9 @@ Sr_iov_feature::setup_vbars()
 void
 Sr_iov_feature::dump(int indent) const
 {
-  printf("%*.sSR-IOV: (%s) vfs=%u ofs=%u stride=%u\n", indent, " ",
+  printf("%*.sSR-IOV: (%s) vfs=%u created=%u ofs=%u stride=%u\n", indent, " ",
          _enabled ? "enabled" : "disabled",
-         _num_vfs.v, _vf_offset.v, _vf_stride.v);
+         _num_vfs.v, _num_created, _vf_offset.v, _vf_stride.v);
 }
 
 bool
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include <pci-tuning.h>
+#include <pci-bridge.h>
+#include <pci-caps.h>
+#ifdef CONFIG_L4IO_PCI_SRIOV
+#include <pci-sriov.h>
+#endif
+
+#include "debug.h"
+#include "hw_device.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace Hw { namespace Pci {
+
+Pcie_tuning::Mps_policy Pcie_tuning::_mps_policy = Pcie_tuning::Mps_default;
+
+namespace {
+
+std::vector<Hw::Device *> &roots()
+{
+  static std::vector<Hw::Device *> r;
+  return r;
+}
+
+bool is_vf(Dev *dev)
+{
+#ifdef CONFIG_L4IO_PCI_SRIOV
+  return dynamic_cast<Sr_iov_vf *>(dev);
+#else
+  (void)dev;
+  return false;
+#endif
+}
+
+unsigned pcie_version(Dev *dev)
+{ return dev->pcie_cap().read<Pcie_cap::Flags>().version(); }
+
+bool is_bridge(Dev *dev)
+{ return dynamic_cast<Bridge_base *>(dev); }
+
+unsigned mps_supported(Dev *dev)
+{ return dev->pcie_cap().read<Pcie_cap::Dev_caps>().max_payload_size_supported(); }
+
+/// Smallest MPS supported by a function and all functions below it.
+unsigned subtree_mps(Hw::Device *node, Dev *dev)
+{
+  unsigned mps = mps_supported(dev);
+  if (!is_bridge(dev))
+    return mps;
+
+  for (auto c = node->begin(0); c != node->end(); ++c)
+    if (Dev *d = Pcie_tuning::pcie_fn(*c))
+      mps = std::min(mps, subtree_mps(*c, d));
+
+  return mps;
+}
+
+void set_mps(Dev *dev, unsigned mps, bool set_mrrs)
+{
+  Cap pcie = dev->pcie_cap();
+  auto ctrl = pcie.read<Pcie_cap::Dev_ctrl>();
+  auto old = ctrl;
+
+  ctrl.max_payload_size() = mps;
+  if (set_mrrs)
+    ctrl.max_read_request_size() = mps;
+
+  if (ctrl.v == old.v)
+    return;
+
+  pcie.write(ctrl);
+  d_printf(DBG_DEBUG, "%02x:%02x.%x: MPS %u -> %u, MRRS %u -> %u\n",
+           dev->bus_nr(), dev->device_nr(), dev->function_nr(),
+           128U << old.max_payload_size(), 128U << ctrl.max_payload_size(),
+           128U << old.max_read_request_size(),
+           128U << ctrl.max_read_request_size());
+}
+
+/**
+ * Configure the PCIe functions on the bus of `node`.
+ *
+ * \param up_mps    MPS of the upstream port, -1 on the root bus.
+ * \param safe_mps  MPS to use with the safe policy, -1 on the root bus.
+ */
+void configure_bus(Hw::Device *node, Pcie_tuning::Mps_policy policy,
+                   int up_mps, int safe_mps)
+{
+  for (auto c = node->begin(0); c != node->end(); ++c)
+    {
+      Dev *dev = Pcie_tuning::pcie_fn(*c);
+      if (!dev)
+        continue;
+
+      unsigned cap = mps_supported(dev);
+      unsigned cur = dev->pcie_cap().read<Pcie_cap::Dev_ctrl>().max_payload_size();
+      int sub_safe = safe_mps;
+      unsigned mps;
+
+      switch (policy)
+        {
+        default:
+        case Pcie_tuning::Mps_default:
+          mps = (up_mps >= 0 && cur > unsigned(up_mps)) ? up_mps : cur;
+          break;
+        case Pcie_tuning::Mps_safe:
+          if (sub_safe < 0)
+            sub_safe = subtree_mps(*c, dev);
+          mps = sub_safe;
+          break;
+        case Pcie_tuning::Mps_performance:
+          mps = up_mps >= 0 ? std::min(cap, unsigned(up_mps)) : cap;
+          break;
+        case Pcie_tuning::Mps_peer2peer:
+          mps = 0;
+          break;
+        }
+
+      if (mps > cap)
+        mps = cap;
+
+      set_mps(dev, mps, policy == Pcie_tuning::Mps_performance);
+
+      if (is_bridge(dev))
+        configure_bus(*c, policy, mps, sub_safe);
+    }
+}
+
+struct Feature_name
+{
+  char const *name;
+  unsigned feature;
+};
+
+Feature_name const feature_names[] =
+{
+  { "relaxed_ordering", Pcie_tuning::F_relaxed_ordering },
+  { "no_snoop",         Pcie_tuning::F_no_snoop },
+  { "ext_tag",          Pcie_tuning::F_ext_tag },
+  { "10bit_tag",        Pcie_tuning::F_tag10 },
+};
+
+int parse_features(std::string const &str, unsigned *features)
+{
+  *features = 0;
+  std::string::size_type pos = 0;
+  while (pos < str.size())
+    {
+      std::string::size_type end = str.find_first_of(", ", pos);
+      if (end == std::string::npos)
+        end = str.size();
+
+      std::string name = str.substr(pos, end - pos);
+      pos = end + 1;
+      if (name.empty() || name == "none")
+        continue;
+
+      bool found = false;
+      for (Feature_name const &f: feature_names)
+        if (name == f.name)
+          {
+            *features |= f.feature;
+            found = true;
+            break;
+          }
+
+      if (!found)
+        {
+          d_printf(DBG_ERR, "error: unknown PCIe feature '%s'\n", name.c_str());
+          return -EINVAL;
+        }
+    }
+
+  return 0;
+}
+
+/// Features a function can use for its own requests.
+unsigned requester_features(Dev *dev)
+{
+  Cap pcie = dev->pcie_cap();
+  unsigned f = Pcie_tuning::F_relaxed_ordering | Pcie_tuning::F_no_snoop;
+
+  if (pcie.read<Pcie_cap::Dev_caps>().ext_tag_supported())
+    f |= Pcie_tuning::F_ext_tag;
+
+  if (pcie_version(dev) >= 2
+      && pcie.read<Pcie_cap::Dev_caps2>().tag10_requester_supported())
+    f |= Pcie_tuning::F_tag10;
+
+  return f;
+}
+
+/// Features a port supports for requests of the functions below it.
+unsigned path_features(Dev *dev)
+{
+  Cap pcie = dev->pcie_cap();
+  unsigned f = Pcie_tuning::F_relaxed_ordering | Pcie_tuning::F_no_snoop;
+
+  if (pcie.read<Pcie_cap::Dev_caps>().ext_tag_supported())
+    f |= Pcie_tuning::F_ext_tag;
+
+  if (pcie_version(dev) >= 2
+      && pcie.read<Pcie_cap::Dev_caps2>().tag10_completer_supported())
+    f |= Pcie_tuning::F_tag10;
+
+  return f;
+}
+
+void set_features(Dev *dev, unsigned f)
+{
+  Cap pcie = dev->pcie_cap();
+  auto ctrl = pcie.read<Pcie_cap::Dev_ctrl>();
+  auto old = ctrl;
+
+  ctrl.relaxed_ordering() = !!(f & Pcie_tuning::F_relaxed_ordering);
+  ctrl.no_snoop() = !!(f & Pcie_tuning::F_no_snoop);
+  ctrl.ext_tag() = !!(f & Pcie_tuning::F_ext_tag);
+
+  bool changed = ctrl.v != old.v;
+  if (changed)
+    pcie.write(ctrl);
+
+  if (pcie_version(dev) >= 2)
+    {
+      auto ctrl2 = pcie.read<Pcie_cap::Dev_ctrl2>();
+      auto old2 = ctrl2;
+      ctrl2.tag10_requester_enable() = !!(f & Pcie_tuning::F_tag10);
+      if (ctrl2.v != old2.v)
+        {
+          pcie.write(ctrl2);
+          changed = true;
+        }
+    }
+
+  if (changed)
+    d_printf(DBG_DEBUG, "%02x:%02x.%x: PCIe features set to %x\n",
+             dev->bus_nr(), dev->device_nr(), dev->function_nr(), f);
+}
+
+/**
+ * Per-device and per-subtree policy for the PCIe transaction features.
+ */
+class Pcie_features_property : public String_property
+{
+public:
+  using String_property::set;
+  int set(int k, std::string const &str) override
+  {
+    unsigned features;
+    int r = parse_features(str, &features);
+    if (r < 0)
+      return r;
+
+    r = String_property::set(k, str);
+    if (r < 0)
+      return r;
+
+    _features = features;
+    Pcie_tuning::configure_all();
+    return 0;
+  }
+
+  /// The features selected for the subtree, -1 if not set.
+  int features() const { return _features; }
+
+private:
+  int _features = -1;
+};
+
+int node_features(Hw::Device *d, int inherited)
+{
+  auto *p =
+    dynamic_cast<Pcie_features_property *>(d->property("pcie_features"));
+  if (p && p->features() >= 0)
+    return p->features();
+  return inherited;
+}
+
+/// Policy of `d` considering the policies of all devices above it.
+int inherited_features(Hw::Device *d)
+{
+  if (!d)
+    return -1;
+  return node_features(d, inherited_features(d->parent()));
+}
+
+/**
+ * Program the transaction features of the PCIe functions on the bus of
+ * `node`.
+ *
+ * \param policy  Features selected for the bus, -1 to keep the settings.
+ * \param path    Features supported by all ports on the path to the root.
+ */
+void configure_features(Hw::Device *node, int policy, unsigned path)
+{
+  for (auto c = node->begin(0); c != node->end(); ++c)
+    {
+      Dev *dev = Pcie_tuning::pcie_fn(*c);
+      if (!dev)
+        continue;
+
+      int features = node_features(*c, policy);
+      if (features >= 0)
+        {
+          unsigned f = features & path & requester_features(dev);
+          if (f != unsigned(features))
+            d_printf(DBG_DEBUG,
+                     "%02x:%02x.%x: PCIe features %x not supported\n",
+                     dev->bus_nr(), dev->device_nr(), dev->function_nr(),
+                     features & ~f);
+          set_features(dev, f);
+        }
+
+      if (is_bridge(dev))
+        configure_features(*c, features, path & path_features(dev));
+    }
+}
+
+class Pcie_bus_property : public String_property
+{
+public:
+  using String_property::set;
+  int set(int k, std::string const &str) override
+  {
+    static char const *const names[] =
+      { "default", "safe", "performance", "peer2peer" };
+
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+      if (str == names[i])
+        {
+          int r = String_property::set(k, str);
+          if (r < 0)
+            return r;
+
+          Pcie_tuning::mps_policy(Pcie_tuning::Mps_policy(i));
+          Pcie_tuning::configure_all();
+          return 0;
+        }
+
+    d_printf(DBG_ERR, "error: unknown PCIe bus policy '%s'\n", str.c_str());
+    return -EINVAL;
+  }
+};
+
+}
+
+Dev *
+Pcie_tuning::pcie_fn(Hw::Device *d)
+{
+  Dev *dev = d->find_feature<Dev>();
+  if (!dev || !dev->is_pcie() || is_vf(dev))
+    return nullptr;
+
+  return dev;
+}
+
+void
+Pcie_tuning::init(Hw::Device *system_bus)
+{
+  system_bus->register_property("pcie_bus", new Pcie_bus_property());
+  system_bus->register_property("pcie_features", new Pcie_features_property());
+  add_aspm_property(system_bus);
+}
+
+void
+Pcie_tuning::add_device(Dev *dev)
+{
+  if (is_vf(dev))
+    return;
+
+  dev->host()->register_property("pcie_features", new Pcie_features_property());
+  add_aspm_device(dev);
+}
+
+void
+Pcie_tuning::configure(Hw::Device *root)
+{
+  auto &r = roots();
+  if (std::find(r.begin(), r.end(), root) == r.end())
+    r.push_back(root);
+
+  configure_bus(root, _mps_policy, -1, -1);
+  configure_features(root, inherited_features(root), ~0U);
+  configure_aspm(root);
+}
+
+void
+Pcie_tuning::configure_all()
+{
+  for (Hw::Device *root: roots())
+    {
+      configure_bus(root, _mps_policy, -1, -1);
+      configure_features(root, inherited_features(root), ~0U);
+      configure_aspm(root);
+    }
+}
+
+} }
@@ -12,10 +12,12 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <utility>
 
 #include "debug.h"
 #include "cfg.h"
 #include "phys_space.h"
+#include "resource.h"
 
 void *operator new (size_t sz, cxx::Nothrow const &) noexcept
 { return malloc(sz); }
@@ -90,6 +92,7 @@ Phys_space::alloc_from(Set::Iterator const &o, Phys_region const &r)
 bool
 Phys_space::reserve(Phys_region const &r)
 {
+  pool_remove(r);
 
   Set::Iterator n;
   bool res = false;
@@ -124,25 +127,136 @@ Phys_space::request(Phys_region const &r)
   return false;
 }
 
-Phys_space::Phys_region
-Phys_space::alloc(Phys_region::Addr sz, Phys_region::Addr align)
+void
+Phys_space::pool_add(Addr s, Addr e)
+{
+  _pool[s] = e;
+  _pool_by_size.insert(std::make_pair(e - s, s));
+}
+
+/**
+ * Remove the range `r` from the free extents of the apertures.
+ */
+void
+Phys_space::pool_remove(Phys_region const &r)
+{
+  auto i = _pool.upper_bound(r.start());
+  if (i != _pool.begin())
+    --i;
+
+  while (i != _pool.end() && i->first <= r.end())
+    {
+      Addr s = i->first;
+      Addr e = i->second;
+      if (e < r.start())
+        {
+          ++i;
+          continue;
+        }
+
+      _pool_by_size.erase(std::make_pair(e - s, s));
+      i = _pool.erase(i);
+
+      if (s < r.start())
+        pool_add(s, r.start() - 1);
+      if (e > r.end())
+        pool_add(r.end() + 1, e);
+    }
+}
+
+bool
+Phys_space::pool_find(Addr sz, Addr align, Addr min, Phys_region *r) const
 {
+  for (auto i = _pool_by_size.lower_bound(std::make_pair(sz - 1, Addr(0)));
+       i != _pool_by_size.end(); ++i)
+    {
+      Addr s = i->second;
+      Addr e = s + i->first;
+      if (e < min)
+        continue;
+
+      if (s < min)
+        s = min;
+
+      Addr as = (s + align) & ~align;
+      if (as < s || as + sz - 1 < as || as + sz - 1 > e)
+        continue;
+
+      *r = Phys_region(as, as + sz - 1);
+      return true;
+    }
+
+  return false;
+}
+
+bool
+Phys_space::add_aperture(Phys_region const &r)
+{
+  if (!r.valid())
+    return false;
+
+  // only the parts not reserved or requested so far are usable
   for (Set::Iterator i = _set.begin(); i != _set.end(); ++i)
     {
-      if (i->start() > Phys_region::Addr(0) - sz)
-	continue;
+      if (i->end() < r.start() || i->start() > r.end())
+        continue;
 
-      Phys_region r((i->start() + align) & ~align, 0);
-      r.set_end(r.start() + sz - 1);
+      Addr s = i->start() < r.start() ? r.start() : i->start();
+      Addr e = i->end() > r.end() ? r.end() : i->end();
+      pool_remove(Phys_region(s, e));
+      pool_add(s, e);
+    }
 
-      if (i->contains(r))
-	{
-	  reserve(r);
-	  return r;
-	}
+  d_printf(DBG_INFO, "  MMIO aperture %014lx-%014lx\n", r.start(), r.end());
+  return true;
+}
+
+Phys_space::Phys_region
+Phys_space::alloc(Phys_region::Addr sz, Phys_region::Addr align,
+                  bool above_4g)
+{
+  if (!sz)
+    return Phys_region();
+
+  Phys_region r;
+  bool found = false;
+
+  // zero if the address space does not extend above 4 GiB
+  Addr const addr_4g = static_cast<Addr>(1ULL << 32);
+  if (above_4g && addr_4g)
+    found = pool_find(sz, align, addr_4g, &r);
+
+  if (!found)
+    found = pool_find(sz, align, 0, &r);
+
+  if (!found)
+    {
+      d_printf(DBG_DEBUG2, "phys space: no free extent for %lx bytes "
+                           "(align %lx), %zu free extents\n",
+               sz, align + 1, _pool.size());
+      return Phys_region();
+    }
+
+  reserve(r);
+  return r;
+}
+
+l4_uint64_t
+Phys_space::max_aligned_block() const
+{
+  l4_uint64_t res = 0;
+  for (auto i = _pool_by_size.rbegin(); i != _pool_by_size.rend(); ++i)
+    {
+      if (i->first < res)
+        break;
+
+      l4_uint64_t b = Resource_space::max_aligned_block(i->second,
+                                                 i->second + i->first);
+      if (b > res)
+        res = b;
     }
 
-  return Phys_region();
+  return res;
 }
 
 void
@@ -9,6 +9,10 @@
 #include <l4/cxx/avl_set>
 #include <l4/sys/l4int.h>
 
+#include <map>
+#include <set>
+#include <utility>
+
 class Phys_space
 {
 public:
@@ -44,17 +48,52 @@ public:
 
   bool reserve(Phys_region const &r);
   bool request(Phys_region const &r);
-  Phys_region alloc(Phys_region::Addr sz, Phys_region::Addr align);
+
+  /**
+   * Declare a range of the physical address space usable for MMIO
+   * allocations.
+   *
+   * Only the parts of the range that are neither reserved by the KIP nor
+   * requested by a device before become available to alloc().
+   */
+  bool add_aperture(Phys_region const &r);
+
+  /**
+   * Allocate an address range from the declared apertures.
+   *
+   * The smallest fitting free extent is used.
+   *
+   * \param sz        Size of the range.
+   * \param align     Alignment of the range, encoded as `alignment - 1`.
+   * \param above_4g  Prefer a range above 4 GiB.
+   *
+   * \return The allocated range, an invalid region if there is no space.
+   */
+  Phys_region alloc(Phys_region::Addr sz, Phys_region::Addr align,
+                    bool above_4g = false);
+
+  /**
+   * Get the largest size-aligned power-of-two range alloc() could return.
+   */
+  l4_uint64_t max_aligned_block() const;
 
   void dump();
 
   static Phys_space space;
 
 private:
+  typedef Phys_region::Addr Addr;
   typedef cxx::Avl_set<Phys_region> Set;
 
   Set _set;
 
-  bool alloc_from(Set::Iterator const &o, Phys_region const &r);
+  /// Free extents of the apertures, start -> end.
+  std::map<Addr, Addr> _pool;
+  /// Free extents of the apertures, (end - start, start).
+  std::set<std::pair<Addr, Addr>> _pool_by_size;
 
+  bool alloc_from(Set::Iterator const &o, Phys_region const &r);
+  void pool_add(Addr s, Addr e);
+  void pool_remove(Phys_region const &r);
+  bool pool_find(Addr sz, Addr align, Addr min, Phys_region *r) const;
 };
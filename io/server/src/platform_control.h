@@ -7,14 +7,16 @@
 #pragma once
 
 #include <l4/sys/platform_control>
+#include <l4/vbus/vbus_platform_stats>
 #include "inhibitor_mux.h"
+#include "timing_stats.h"
 #include <l4/sys/cxx/ipc_epiface>
 
 namespace Hw { class Root_bus; }
 
 class Platform_control
 : public Inhibitor_mux,
-  public L4::Epiface_t<Platform_control, L4::Platform_control>
+  public L4::Epiface_t<Platform_control, L4vbus::Platform_stats>
 {
 public:
   explicit Platform_control(Hw::Root_bus *hw_root)
@@ -43,6 +45,10 @@ public:
   int op_cpu_disable(L4::Platform_control::Rights, l4_umword_t)
   { return -L4_ENOSYS; }
 
+  long op_timing(L4vbus::Platform_stats::Rights, l4_umword_t category,
+                 l4_umword_t index, l4vbus_timing_record_t &rec)
+  { return Timing_stats::get(category, index, &rec); }
+
 private:
   enum State_bits
   {
@@ -1,48 +1,303 @@
 #include "debug.h"
 #include "pm.h"
+#include "timing_stats.h"
+#include "worker_pool.h"
 
+#include <pthread.h>
+#include <algorithm>
 #include <cerrno>
+#include <deque>
+#include <map>
+#include <vector>
 
 
 Pm::Pm_list Pm::_online(true);
 Pm::Pm_list Pm::_suspended(true);
+pthread_mutex_t Pm::_list_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned Pm::_workers = 1;
+
+namespace {
+
+/**
+ * A PM operation on a single object, together with its dependencies.
+ *
+ * A job becomes ready as soon as all jobs it depends on (`pending`) are
+ * done; completing a job releases the jobs in `next`. `order` is the
+ * position of the object in the PM list.
+ */
+struct Pm_job
+{
+  Pm *pm;
+  unsigned order;
+  unsigned pending = 0;
+  std::vector<Pm_job *> next;
+
+  Pm_job(Pm *pm, unsigned order) : pm(pm), order(order) {}
+};
+
+/**
+ * Run a set of dependent PM jobs on a pool of threads.
+ *
+ * The calling thread takes part in the processing, so a pool with a single
+ * worker processes all jobs sequentially without creating any thread.
+ * Ready jobs are started in the order of the PM list, so a single worker
+ * processes the objects in the same order as a plain walk of the list as
+ * far as the dependencies allow. Some devices rely on that order for
+ * dependencies not expressed by pm_parent().
+ */
+class Pm_runner
+{
+public:
+  typedef int (*Op)(Pm_job *);
+
+  Pm_runner(Op op, bool abort_on_error)
+  : _op(op), _abort_on_error(abort_on_error)
+  {
+    pthread_mutex_init(&_lock, 0);
+    pthread_cond_init(&_cond, 0);
+  }
+
+  ~Pm_runner()
+  {
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_lock);
+  }
+
+  void add_ready(Pm_job *j) { _ready.push_back(j); }
+
+  int run(unsigned workers)
+  {
+    // the helpers share the worker pool with the asynchronous device
+    // initialization, threads are created on demand
+    std::vector<Helper> helpers;
+    for (unsigned i = 1; i < workers && i < _ready.size(); ++i)
+      helpers.push_back(Helper(this));
+
+    Worker_pool::reserve(helpers.size());
+    for (auto &h: helpers)
+      Worker_pool::submit(&h);
+
+    worker();
+
+    for (auto &h: helpers)
+      Worker_pool::wait(&h);
+
+    return _result;
+  }
+
+private:
+  struct Helper : Worker_pool::Job
+  {
+    Pm_runner *r;
+
+    explicit Helper(Pm_runner *r) : r(r) {}
+    void run() override { r->worker(); }
+  };
+
+  /// Queue a released job at its position in the PM list order.
+  void insert_ready(Pm_job *j)
+  {
+    auto pos = std::upper_bound(_ready.begin(), _ready.end(), j,
+                                [](Pm_job const *a, Pm_job const *b)
+                                { return a->order < b->order; });
+    _ready.insert(pos, j);
+  }
+
+  void worker()
+  {
+    pthread_mutex_lock(&_lock);
+    for (;;)
+      {
+        while (_ready.empty() && _running && !_stop)
+          pthread_cond_wait(&_cond, &_lock);
+
+        // nothing ready and nothing in flight means all jobs are done
+        if (_ready.empty() || _stop)
+          break;
+
+        Pm_job *j = _ready.front();
+        _ready.pop_front();
+        ++_running;
+        pthread_mutex_unlock(&_lock);
+
+        int res = _op(j);
+
+        pthread_mutex_lock(&_lock);
+        --_running;
+        if (res < 0 && _abort_on_error)
+          {
+            _stop = true;
+            _result = res;
+          }
+        else
+          for (auto n: j->next)
+            if (--n->pending == 0)
+              insert_ready(n);
+
+        pthread_cond_broadcast(&_cond);
+      }
+    pthread_mutex_unlock(&_lock);
+  }
+
+  Op _op;
+  bool _abort_on_error;
+  bool _stop = false;
+  int _result = 0;
+  unsigned _running = 0;
+  std::deque<Pm_job *> _ready;
+  pthread_mutex_t _lock;
+  pthread_cond_t _cond;
+};
+
+/// The jobs of a PM list, in list order.
+struct Job_list
+{
+  std::vector<Pm_job *> jobs;
+  std::map<Pm *, Pm_job *> by_pm;
+};
+
+/**
+ * Create a job for each object in `list` and link each job with the job of
+ * its nearest PM ancestor that is part of the list as well.
+ *
+ * \param up  Jobs wait for their children (suspend) if true, for their
+ *            parent (resume) otherwise.
+ */
+template<typename LIST>
+static void
+build_jobs(LIST const &list, bool up, Job_list *jobs)
+{
+  unsigned order = 0;
+  for (auto i = list.begin(); i != list.end(); ++i)
+    {
+      Pm_job *j = new Pm_job(*i, order++);
+      jobs->jobs.push_back(j);
+      jobs->by_pm[*i] = j;
+    }
+
+  for (Pm_job *j: jobs->jobs)
+    {
+      // skip ancestors without a job, e.g. disabled ones, so the order
+      // between the job and the rest of its ancestors is kept
+      Pm_job *p = nullptr;
+      for (Pm *a = j->pm->pm_parent(); a && !p; a = a->pm_parent())
+        {
+          auto i = jobs->by_pm.find(a);
+          if (i != jobs->by_pm.end())
+            p = i->second;
+        }
+
+      if (!p)
+        continue;
+
+      Pm_job *first = up ? j : p;
+      Pm_job *second = up ? p : j;
+      first->next.push_back(second);
+      ++second->pending;
+    }
+}
+
+static void
+free_jobs(Job_list *jobs)
+{
+  for (Pm_job *j: jobs->jobs)
+    delete j;
+  jobs->jobs.clear();
+  jobs->by_pm.clear();
+}
+
+static void
+add_ready_jobs(Pm_runner *r, Job_list const &jobs)
+{
+  for (Pm_job *j: jobs.jobs)
+    if (!j->pending)
+      r->add_ready(j);
+}
+
+}
 
 int
 Pm::pm_suspend_all()
 {
-  while (Pm *c = _online.front())
+  Job_list jobs;
+  pthread_mutex_lock(&_list_lock);
+  build_jobs(_online, true, &jobs);
+  pthread_mutex_unlock(&_list_lock);
+
+  Timing_stats::clear(L4VBUS_TIMING_PM_SUSPEND);
+  l4_uint64_t start = Timing_stats::now_us();
+
+  Pm_runner r([](Pm_job *j)
     {
+      Pm *c = j->pm;
+      l4_uint64_t t = Timing_stats::now_us();
       int res = c->pm_suspend();
+      Timing_stats::record(L4VBUS_TIMING_PM_SUSPEND, c->pm_name(),
+                           Timing_stats::now_us() - t, res);
       if (res < 0)
         {
-          d_printf(DBG_ERR, "error: pm_suspend failed for %p: %d, aborting\n", c, res);
+          d_printf(DBG_ERR, "error: pm_suspend failed for %s: %d, aborting\n",
+                   c->pm_name().c_str(), res);
           return res;
         }
 
-      if (_online.front() == c || c->pm_is_online())
+      if (c->pm_is_online())
         {
-          d_printf(DBG_ERR, "error: pm_suspend failed for %p, not dequeued from online list, aborting\n", c);
+          d_printf(DBG_ERR, "error: pm_suspend failed for %s, not dequeued "
+                            "from online list, aborting\n",
+                   c->pm_name().c_str());
           return -EBUSY;
         }
-    }
-  return 0;
+      return 0;
+    }, true);
+
+  add_ready_jobs(&r, jobs);
+  int res = r.run(_workers);
+  free_jobs(&jobs);
+
+  Timing_stats::record(L4VBUS_TIMING_PM_SUSPEND, "total",
+                       Timing_stats::now_us() - start, res);
+  return res;
 }
 
 int
 Pm::pm_resume_all()
 {
-  while (Pm *c = _suspended.front())
+  Job_list jobs;
+  pthread_mutex_lock(&_list_lock);
+  build_jobs(_suspended, false, &jobs);
+  pthread_mutex_unlock(&_list_lock);
+
+  Timing_stats::clear(L4VBUS_TIMING_PM_RESUME);
+  l4_uint64_t start = Timing_stats::now_us();
+
+  Pm_runner r([](Pm_job *j)
     {
+      Pm *c = j->pm;
+      l4_uint64_t t = Timing_stats::now_us();
       int res = c->pm_resume();
+      Timing_stats::record(L4VBUS_TIMING_PM_RESUME, c->pm_name(),
+                           Timing_stats::now_us() - t, res);
       if (res < 0)
-        d_printf(DBG_ERR, "error: pm_resume failed for %p: %d\n", c, res);
+        d_printf(DBG_ERR, "error: pm_resume failed for %s: %d\n",
+                 c->pm_name().c_str(), res);
 
-      if (_suspended.front() == c)
+      if (c->pm_is_suspended())
         {
-          d_printf(DBG_ERR, "error: pm_resume failed for %p, not dequeued from suspended list\n", c);
-          _suspended.remove(c);
+          d_printf(DBG_ERR, "error: pm_resume failed for %s, not dequeued "
+                            "from suspended list\n", c->pm_name().c_str());
           c->pm_set_state(Pm_failed);
         }
-    }
+
+      // a failed device must not keep its children suspended
+      return 0;
+    }, false);
+
+  add_ready_jobs(&r, jobs);
+  r.run(_workers);
+  free_jobs(&jobs);
+
+  Timing_stats::record(L4VBUS_TIMING_PM_RESUME, "total",
+                       Timing_stats::now_us() - start, 0);
   return 0;
 }
@@ -8,6 +8,9 @@
 
 #include <l4/cxx/hlist>
 
+#include <pthread.h>
+#include <string>
+
 struct Pm : public cxx::H_list_item_t<Pm>
 {
   enum Pm_state
@@ -31,9 +34,28 @@ struct Pm : public cxx::H_list_item_t<Pm>
   virtual int pm_resume() = 0;
   virtual ~Pm() = 0;
 
+  /**
+   * Get the PM parent of this object.
+   *
+   * A PM object is suspended only after all its children are suspended and
+   * resumed only after its parent is resumed. Objects without a parent
+   * relation are processed independently of each other.
+   */
+  virtual Pm *pm_parent() const { return nullptr; }
+
+  /// Name used for diagnostics and timing records.
+  virtual std::string pm_name() const { return std::string(); }
+
   static int pm_suspend_all();
   static int pm_resume_all();
 
+  /**
+   * Set the number of threads used to suspend and resume independent
+   * subtrees concurrently (1 means sequential processing).
+   */
+  static void pm_set_workers(unsigned workers)
+  { _workers = workers ? workers : 1; }
+
 protected:
   void pm_set_state(Pm_state state)
   {
@@ -42,6 +64,9 @@ protected:
     if (old == state)
       return;
 
+    // the lists are shared by all PM objects, which may change their state
+    // concurrently during pm_suspend_all() and pm_resume_all()
+    pthread_mutex_lock(&_list_lock);
     _state = state;
 
     switch (old)
@@ -57,12 +82,15 @@ protected:
       case Pm_online:    _online.push_front(this); break;
       default: break;
       }
+    pthread_mutex_unlock(&_list_lock);
   }
 
   typedef cxx::H_list_t<Pm> Pm_list;
 
   static Pm_list _online;
   static Pm_list _suspended;
+  static pthread_mutex_t _list_lock;
+  static unsigned _workers;
 
 private:
   Pm_state _state;
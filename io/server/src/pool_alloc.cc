@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include "pool_alloc.h"
+
+#include <cstdio>
+#include <new>
+#include <pthread.h>
+
+namespace {
+
+enum { Num_classes = Pool_alloc::Max_size / Pool_alloc::Granule };
+
+struct Free_obj
+{
+  Free_obj *next;
+};
+
+struct Size_class
+{
+  Free_obj *free = nullptr;
+  unsigned long in_use = 0;
+  unsigned long num_free = 0;
+};
+
+pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+Size_class _classes[Num_classes];
+
+char *_cur;            ///< next free byte of the current block
+char *_end;            ///< end of the current block
+std::size_t _blocks;   ///< number of blocks taken from the heap
+unsigned long _large;  ///< objects passed on to the heap
+std::size_t _large_bytes;
+
+unsigned
+size_class(std::size_t sz)
+{ return (sz + Pool_alloc::Granule - 1) / Pool_alloc::Granule - 1; }
+
+}
+
+void *
+Pool_alloc::alloc(std::size_t sz)
+{
+  if (sz == 0 || sz > Max_size)
+    {
+      void *p = ::operator new(sz);
+      pthread_mutex_lock(&_lock);
+      ++_large;
+      _large_bytes += sz;
+      pthread_mutex_unlock(&_lock);
+      return p;
+    }
+
+  unsigned c = size_class(sz);
+  std::size_t csz = (c + 1) * Granule;
+  Size_class &cls = _classes[c];
+
+  pthread_mutex_lock(&_lock);
+  void *p;
+  if (cls.free)
+    {
+      p = cls.free;
+      cls.free = cls.free->next;
+      --cls.num_free;
+    }
+  else
+    {
+      if (std::size_t(_end - _cur) < csz)
+        {
+          char *b;
+          try
+            {
+              b = static_cast<char *>(::operator new(Block_size));
+            }
+          catch (...)
+            {
+              pthread_mutex_unlock(&_lock);
+              throw;
+            }
+
+          ++_blocks;
+          _cur = b;
+          _end = b + Block_size;
+        }
+
+      p = _cur;
+      _cur += csz;
+    }
+
+  ++cls.in_use;
+  pthread_mutex_unlock(&_lock);
+  return p;
+}
+
+void
+Pool_alloc::free(void *p, std::size_t sz)
+{
+  if (!p)
+    return;
+
+  if (sz == 0 || sz > Max_size)
+    {
+      ::operator delete(p);
+      pthread_mutex_lock(&_lock);
+      --_large;
+      _large_bytes -= sz;
+      pthread_mutex_unlock(&_lock);
+      return;
+    }
+
+  Size_class &cls = _classes[size_class(sz)];
+  Free_obj *o = static_cast<Free_obj *>(p);
+
+  pthread_mutex_lock(&_lock);
+  o->next = cls.free;
+  cls.free = o;
+  --cls.in_use;
+  ++cls.num_free;
+  pthread_mutex_unlock(&_lock);
+}
+
+void
+Pool_alloc::print_stats(bool classes)
+{
+  pthread_mutex_lock(&_lock);
+
+  unsigned long objs = 0;
+  std::size_t used = 0;
+  std::size_t free = 0;
+  for (unsigned c = 0; c < Num_classes; ++c)
+    {
+      std::size_t csz = (c + 1) * Granule;
+      Size_class const &cls = _classes[c];
+      objs += cls.in_use;
+      used += cls.in_use * csz;
+      free += cls.num_free * csz;
+
+      if (classes && (cls.in_use || cls.num_free))
+        printf("  %4zu bytes: %lu in use, %lu free\n",
+               csz, cls.in_use, cls.num_free);
+    }
+
+  std::size_t total = _blocks * Block_size;
+  printf("Device tree pools: %zu KiB in %zu blocks, %lu objects using %zu KiB, "
+         "%zu KiB free, %zu KiB unused\n",
+         total >> 10, _blocks, objs, used >> 10, free >> 10,
+         (total - used - free) >> 10);
+  printf("Device tree objects on the heap: %lu using %zu KiB\n",
+         _large, _large_bytes >> 10);
+
+  pthread_mutex_unlock(&_lock);
+}
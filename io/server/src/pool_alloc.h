@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Allocator for the small, long-lived objects of the device trees.
+ *
+ * Objects are rounded up to size classes of `Granule` bytes and carved in
+ * allocation order from large blocks of the heap, so objects created
+ * together (a device, its resources and properties) end up next to each
+ * other. Freed objects are kept on a free list per size class for reuse,
+ * the blocks are never returned to the heap. Objects larger than `Max_size`
+ * are passed on to the heap. All functions are thread safe.
+ */
+class Pool_alloc
+{
+public:
+  enum
+  {
+    Granule    = 16,
+    Max_size   = 1024,
+    Block_size = 64 << 10,
+  };
+
+  static void *alloc(std::size_t sz);
+  static void free(void *p, std::size_t sz);
+
+  /**
+   * Print the memory use of the pools.
+   *
+   * \param classes  Also print the use of each size class.
+   */
+  static void print_stats(bool classes);
+};
+
+/**
+ * Base for classes whose objects are allocated with Pool_alloc.
+ *
+ * Derived classes must have a virtual destructor if objects are deleted via
+ * a pointer to a base class, so that the size of the object is known.
+ */
+class Pool_object
+{
+public:
+  static void *operator new(std::size_t sz)
+  { return Pool_alloc::alloc(sz); }
+
+  static void operator delete(void *p, std::size_t sz)
+  { Pool_alloc::free(p, sz); }
+};
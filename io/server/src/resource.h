@@ -18,6 +18,7 @@
 #include <l4/re/util/unique_cap>
 #include <l4/re/rm>
 
+#include "pool_alloc.h"
 #include "res.h"
 
 class Resource;
@@ -65,11 +66,44 @@ public:
                      Resource *child, Device *cdev, bool resize) = 0;
   virtual bool adjust_children(Resource *self) = 0;
 
+  /**
+   * Get the largest block alloc() could place into `parent` right now.
+   *
+   * Only size-aligned blocks of a power-of-two size are considered, as
+   * needed for PCI BARs. `parent` is not grown.
+   *
+   * \return The size of the block in bytes, 0 if unknown.
+   */
+  virtual l4_uint64_t max_alloc_block(Resource const * /*parent*/)
+  { return 0; }
+
+  /**
+   * Notify the space that `child`, allocated from it, changed its address
+   * or size.
+   */
+  virtual void child_moved(Resource const * /*child*/) {}
+
+  /**
+   * Get the largest size-aligned power-of-two block within [start, end].
+   */
+  static l4_uint64_t max_aligned_block(l4_uint64_t start, l4_uint64_t end)
+  {
+    for (int b = 63; b >= 0; --b)
+      {
+        l4_uint64_t sz = l4_uint64_t{1} << b;
+        l4_uint64_t a = (start + sz - 1) & ~(sz - 1);
+        if (a >= start && a <= end && end - a >= sz - 1)
+          return sz;
+      }
+
+    return 0;
+  }
+
 protected:
   ~Resource_space() noexcept = default;
 };
 
-class Resource
+class Resource : public Pool_object
 {
 private:
   unsigned long _f = 0;
@@ -130,6 +164,11 @@ public:
     Irq_type_raising_edge = unsigned{L4_IRQ_F_POS_EDGE}   * Irq_type_base,
     Irq_type_falling_edge = unsigned{L4_IRQ_F_NEG_EDGE}   * Irq_type_base,
     Irq_type_both_edges   = unsigned{L4_IRQ_F_BOTH_EDGE}  * Irq_type_base,
+
+    /// The interrupt is a transparent MSI of a PCI device, exposed on vBUS.
+    Irq_mode_msi          = unsigned{L4VBUS_RESOURCE_F_IRQ_MSI}  * Irq_type_base,
+    /// The interrupt is a transparent MSI-X of a PCI device, exposed on vBUS.
+    Irq_mode_msix         = unsigned{L4VBUS_RESOURCE_F_IRQ_MSIX} * Irq_type_base,
   };
   static_assert(F_prefetchable == Mem_type_prefetchable);
   static_assert(F_cached_mem == Mem_type_cacheable);
@@ -225,6 +264,23 @@ public:
 
   virtual Resource_space *provided() const { return 0; }
 
+  /**
+   * Choose the size of the resource right before it is allocated from the
+   * windows of `parent`.
+   *
+   * Only resources with a size negotiable at allocation time, such as
+   * resizable PCI BARs, implement this.
+   */
+  virtual void fit_alloc(Device * /*parent*/) {}
+
+  /**
+   * Pick a smaller size after the allocation of the resource failed.
+   *
+   * \retval true   The size changed, the allocation is worth another try.
+   * \retval false  There is no smaller size to try.
+   */
+  virtual bool shrink_alloc() { return false; }
+
   void dump(char const *type, int indent) const;
   virtual void dump(int indent = 0) const;
 
@@ -247,6 +303,12 @@ private:
 
   void _start_end(Addr s, Addr e) { _s = s; _e = e; }
 
+  void moved() const
+  {
+    if (_p && _p->provided())
+      _p->provided()->child_moved(this);
+  }
+
 public:
   void set_empty() { _s = _e = 0; set_empty(true); }
 
@@ -278,29 +340,39 @@ public:
   bool contains(Resource const &o) const
   { return start() <= o.start() && end() >= o.end(); }
 
-  void start(Addr start) { _e = start + (_e - _s); _s = start; }
+  void start(Addr start)
+  {
+    _e = start + (_e - _s);
+    _s = start;
+    moved();
+  }
+
   void end(Addr end)
   {
     _e = end;
     set_empty(false);
+    moved();
   }
 
   void size(Size size)
   {
     _e = _s - 1 + size;
     set_empty(false);
+    moved();
   }
 
   void start_end(Addr start, Addr end)
   {
     _start_end(start, end);
     set_empty(false);
+    moved();
   }
 
   void start_size(Addr start, Size s)
   {
     _start_end(start, start - 1 + s);
     set_empty(false);
+    moved();
   }
 
   bool is_64bit() const { return flags() & F_width_64bit; }
@@ -17,8 +17,11 @@
 #include "device.h"
 #include "resource_provider.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cassert>
+#include <iterator>
+#include <vector>
 
 
 bool
@@ -37,22 +40,159 @@ Resource_provider::_RS::request(Resource *parent, Device *,
   if (end > parent->end())
     return false;
 
-  Resource_list::iterator r = _rl.begin();
-  while (true)
+  // the free extents do not depend on the order of the children, which
+  // assign() and moved children do not keep sorted by address
+  sync_free(parent);
+  if (!carve_free(start, end))
+    return false;
+
+  insert_child(child);
+  child->parent(parent);
+  return true;
+}
+
+void
+Resource_provider::_RS::insert_child(Resource *child)
+{
+  if (_rl_by_addr)
     {
-      if (r == _rl.end() || (*r)->start() > end)
-       {
-         // insert before r
-         _rl.insert(r, child);
-         child->parent(parent);
-         return true;
-       }
-
-      if ((*r)->end() >= start)
-       return false;
-
-      ++r;
+      auto p = std::upper_bound(_rl.begin(), _rl.end(), child,
+                                [](Resource const *a, Resource const *b)
+                                { return a->start() < b->start(); });
+      _rl.insert(p, child);
+      return;
+    }
+
+  auto p = _rl.begin();
+  while (p != _rl.end() && (*p)->start() <= child->end())
+    ++p;
+
+  _rl.insert(p, child);
+}
+
+/**
+ * Build the index of free extents of `parent` if it is outdated.
+ */
+void
+Resource_provider::_RS::sync_free(Resource const *parent)
+{
+  if (_free_valid && _free_start == parent->start()
+      && _free_end == parent->end())
+    return;
+
+  _free.clear();
+  _free_by_size.clear();
+  _free_start = parent->start();
+  _free_end = parent->end();
+  _free_valid = true;
+
+  if (parent->end() < parent->start())
+    return;
+
+  std::vector<std::pair<Addr, Addr>> used;
+  used.reserve(_rl.size());
+  for (auto r: _rl)
+    if (r->start() <= r->end())
+      used.emplace_back(r->start(), r->end());
+
+  std::sort(used.begin(), used.end());
+
+  Addr next = parent->start();
+  for (auto const &u: used)
+    {
+      if (u.second < next)
+        continue;
+
+      if (u.first > next)
+        add_free(next, cxx::min(u.first - 1, parent->end()));
+
+      if (u.second >= parent->end())
+        return;
+
+      next = u.second + 1;
     }
+
+  add_free(next, parent->end());
+}
+
+void
+Resource_provider::_RS::add_free(Addr start, Addr end)
+{
+  _free[start] = end;
+  _free_by_size.emplace(end - start, start);
+}
+
+void
+Resource_provider::_RS::remove_free(std::map<Addr, Addr>::iterator f)
+{
+  _free_by_size.erase(std::make_pair(f->second - f->first, f->first));
+  _free.erase(f);
+}
+
+/**
+ * Remove [start, end] from the free extents.
+ *
+ * \return false if the range is not completely free.
+ */
+bool
+Resource_provider::_RS::carve_free(Addr start, Addr end)
+{
+  auto f = _free.upper_bound(start);
+  if (f == _free.begin())
+    return false;
+
+  --f;
+  Addr fs = f->first;
+  Addr fe = f->second;
+  if (end > fe)
+    return false;
+
+  remove_free(f);
+  if (fs < start)
+    add_free(fs, start - 1);
+  if (end < fe)
+    add_free(end + 1, fe);
+
+  return true;
+}
+
+/**
+ * Find the smallest free extent that can hold `size` bytes with the given
+ * alignment at or above `min_addr`.
+ *
+ * If the start of the extent does not have the required alignment, the
+ * resource is placed at the highest aligned address instead, so that the
+ * remaining free space stays in one piece.
+ */
+bool
+Resource_provider::_RS::find_free(Size size, Size align, Addr min_addr,
+                                  Addr *start) const
+{
+  for (auto i = _free_by_size.lower_bound(std::make_pair(size - 1, Addr{0}));
+       i != _free_by_size.end(); ++i)
+    {
+      Addr fs = i->second;
+      Addr fe = fs + i->first;
+      if (fe < min_addr)
+        continue;
+
+      Addr lo = cxx::max(fs, min_addr);
+      Addr a = (lo + align) & ~align;
+      if (a < lo || a > fe || fe - a < size - 1)
+        continue;
+
+      if (a != fs)
+        {
+          Addr top = (fe - (size - 1)) & ~align;
+          if (top > a)
+            a = top;
+        }
+
+      *start = a;
+      return true;
+    }
+
+  return false;
 }
 
 void
@@ -67,6 +207,8 @@ Resource_provider::_RS::assign(Resource *parent, Resource *child)
 
   _rl.insert(p, child);
   child->parent(parent);
+  _rl_by_addr = false;
+  _free_valid = false;
 
   auto f = _rl.front();
   if (f->alignment() > parent->alignment())
@@ -82,71 +224,139 @@ Resource_provider::_RS::assign(Resource *parent, Resource *child)
       sz += r->size();
     }
 
+  sz = (sz + _granularity) & ~_granularity;
   if (sz > parent->size())
     parent->size(sz);
 }
 
 /**
- * Allocating child resources from the resource list '_rl'.
+ * Allocating child resources from the free extents of the window.
  *
- * Resource alignment is enforced.
+ * Resource alignment is enforced. The smallest fitting free extent is used,
+ * 64-bit prefetchable memory is placed above 4 GiB if possible.
 */
 bool
 Resource_provider::_RS::alloc(Resource *parent, Device *pdev,
                               Resource *child, Device *cdev,
                               bool resize)
 {
-  Resource_list::iterator p = _rl.begin();
-  Addr start = parent->start();
-  Addr end;
   Size min_align = this->min_align(parent);
+  Size align = cxx::max<Size>(child->alignment(), min_align);
+  Size size = child->size();
+  if (!size)
+    return false;
+
+  sync_free(parent);
 
-  if (p != _rl.end() && (*p)->start() == start)
+  Addr const above_4g = Addr{1} << 32;
+  Addr start;
+  bool found = false;
+
+  if (parent->end() >= above_4g && fits_above_4g(child))
+    found = find_free(size, align, above_4g, &start);
+
+  if (!found)
+    found = find_free(size, align, parent->start(), &start);
+
+  if (!found && !resize)
     {
-      start = (*p)->end() + 1;
-      ++p;
+      d_printf(DBG_DEBUG2, "%s: no free extent for %llx bytes (align %llx), "
+                           "%zu free extents, largest %llx bytes\n",
+               res_type_name(), size, align + 1, _free.size(),
+               _free_by_size.empty() ? 0ULL
+                                     : _free_by_size.rbegin()->first + 1);
+      return false;
     }
 
-  while (true)
+  if (!found)
     {
-      if (p != _rl.end())
-       end = (*p)->start() - 1;
-      else
-       end = parent->end();
-
-      Size align = cxx::max<Size>(child->alignment(), min_align);
-      start = (start + align) & ~align; // pad to get alignment
-
-      if (start < end && end - start >= static_cast<Addr>(child->size()) - 1)
-       {
-         child->start(start);
-         break;
-       }
-
-      if (p == _rl.end() && !resize)
-       return false;
-
-      if (p == _rl.end() && resize)
-       {
-         end = start + child->size() - 1;
-         if (end < start)
-           return false; // wrapped around
-
-         parent->end(end);
-         child->start(start);
-         break;
-       }
-
-      start = (*p)->end() + 1;
-      ++p;
+      // grow the window behind the last child
+      Addr tail = parent->end() + 1;
+      auto last = _free.empty() ? _free.end() : std::prev(_free.end());
+      if (last != _free.end() && last->second == parent->end())
+        {
+          tail = last->first;
+          remove_free(last);
+        }
+
+      if (tail < parent->start())
+        tail = parent->start();
+
+      start = (tail + align) & ~align; // pad to get alignment
+      Addr end = start + size - 1;
+      if (end < start)
+        {
+          _free_valid = false;
+          return false; // wrapped around
+        }
+
+      end |= _granularity;
+      parent->end(end);
+      add_free(tail, end);
+      _free_end = end;
     }
 
+  child->start(start);
+
   if (child->provided())
     child->provided()->adjust_children(child);
 
   return request(parent, pdev, child, cdev);
 }
 
+void
+Resource_provider::_RS::child_moved(Resource const *)
+{
+  // the child may overlap other extents or be out of order now
+  _free_valid = false;
+  _rl_by_addr = false;
+}
+
+l4_uint64_t
+Resource_provider::_RS::max_alloc_block(Resource const *parent)
+{
+  sync_free(parent);
+
+  l4_uint64_t res = 0;
+  // going down the sizes, no smaller extent can hold a larger block
+  for (auto i = _free_by_size.rbegin(); i != _free_by_size.rend(); ++i)
+    {
+      if (i->first < res)
+        break;
+
+      res = cxx::max(res, max_aligned_block(i->second,
+                                            i->second + i->first));
+    }
+
+  return res;
+}
+
+/**
+ * Check whether a resource may be placed above 4 GiB.
+ *
+ * This applies to 64-bit prefetchable memory, and for windows only if all
+ * memory inside the window is 64-bit as well.
+ */
+bool
+Resource_provider::_RS::fits_above_4g(Resource const *r)
+{
+  if (r->type() != Mmio_res || !r->is_64bit() || !r->prefetchable())
+    return false;
+
+  if (!r->provided())
+    return true;
+
+  auto const *rs = dynamic_cast<_RS const *>(r->provided());
+  if (!rs)
+    return false;
+
+  for (auto c: rs->_rl)
+    if (!fits_above_4g(c))
+      return false;
+
+  return true;
+}
+
 /**
  * Relocate child resources according to the resource list '_rl'.
  *
@@ -157,6 +367,7 @@ Resource_provider::_RS::adjust_children(Resource *self)
 {
   Addr start = self->start();
   Size min_align = this->min_align(self);
+  bool skipped = false;
 
   for (auto c: _rl)
     {
@@ -164,6 +375,7 @@ Resource_provider::_RS::adjust_children(Resource *self)
         {
           d_printf(DBG_WARN,
                    "internal warning: skipped unallocated fixed / relative resource\n");
+          skipped = true;
           continue;
         }
 
@@ -186,5 +398,9 @@ Resource_provider::_RS::adjust_children(Resource *self)
       if (c->provided())
         c->provided()->adjust_children(c);
     }
+
+  // the children are laid out in list order now
+  _free_valid = false;
+  _rl_by_addr = !skipped;
   return true;
 }
@@ -10,6 +10,10 @@
 
 #include "resource.h"
 
+#include <map>
+#include <set>
+#include <utility>
+
 class Device;
 
 class Resource_provider : public Resource
@@ -22,6 +26,29 @@ private:
     typedef Resource::Size Size;
     Resource_list _rl;
 
+    /**
+     * Index of the free extents of the provided window.
+     *
+     * The index is built on demand by alloc() and request() and kept up to
+     * date by both. It is dropped whenever the children are laid out by
+     * assign() or adjust_children(), or a child is moved or resized, and
+     * rebuilt if the window changed.
+     */
+    std::map<Addr, Addr> _free;                    ///< start -> end
+    std::set<std::pair<Size, Addr>> _free_by_size; ///< (size, start)
+    Addr _free_start = 0;
+    Addr _free_end = 0;
+    bool _free_valid = false;
+    bool _rl_by_addr = true; ///< `_rl` is sorted by address
+    Size _granularity = 0;   ///< the window size is a multiple of this + 1
+
+    void sync_free(Resource const *parent);
+    void add_free(Addr start, Addr end);
+    void remove_free(std::map<Addr, Addr>::iterator f);
+    bool carve_free(Addr start, Addr end);
+    bool find_free(Size size, Size align, Addr min_addr, Addr *start) const;
+    void insert_child(Resource *child);
+
     Size min_align(Resource const *r) const
     {
       switch (r->type())
@@ -34,6 +61,8 @@ private:
 
 
   public:
+    static bool fits_above_4g(Resource const *r);
+
     char const *res_type_name() const override
     { return "RS"; }
 
@@ -43,6 +72,11 @@ private:
                Device *cdev, bool resize) override;
     void assign(Resource *parent, Resource *child) override;
     bool adjust_children(Resource *self) override;
+    l4_uint64_t max_alloc_block(Resource const *parent) override;
+    void child_moved(Resource const *) override;
+
+    void granularity(Size g) { _granularity = g; }
+    Size granularity() const { return _granularity; }
   };
 
   mutable _RS _rs;
@@ -56,4 +90,24 @@ public:
 
   Resource_space *provided() const override
   { return &_rs; }
+
+  /**
+   * Set the granularity of the window when sized from its children.
+   *
+   * \param g  The granularity, encoded as `size - 1`, e.g. 0xfffff for the
+   *           1 MiB granularity of PCI-PCI bridge memory windows.
+   */
+  void granularity(Size g) { _rs.granularity(g); }
+
+  /// Get the granularity of the window, see granularity(Size).
+  Size granularity() const { return _rs.granularity(); }
+
+  /**
+   * Check whether a resource may be placed above 4 GiB.
+   *
+   * This applies to 64-bit prefetchable memory, and for windows only if all
+   * memory inside the window is 64-bit as well.
+   */
+  static bool fits_above_4g(Resource const *r)
+  { return _RS::fits_above_4g(r); }
 };
@@ -44,3 +44,6 @@ int server_loop()
   return 0;
 }
 
+void server_add_timeout(L4::Ipc_svr::Timeout *t, l4_kernel_clock_t when)
+{ svr()->add_timeout(t, when); }
+
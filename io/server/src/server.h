@@ -7,11 +7,15 @@
 #pragma once
 
 #include <l4/re/util/object_registry>
+#include <l4/cxx/ipc_timeout_queue>
 
 extern L4Re::Util::Object_registry *registry;
 
 int server_loop();
 
+/// Run `t` from the server loop once the KIP clock reaches `when`.
+void server_add_timeout(L4::Ipc_svr::Timeout *t, l4_kernel_clock_t when);
+
 namespace Internal {
 
 static struct Io_svr_init
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include "timing_stats.h"
+#include "utils.h"
+
+#include <l4/re/env>
+#include <l4/sys/kip.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+typedef std::vector<l4vbus_timing_record_t> Record_list;
+
+static Record_list _records[L4VBUS_TIMING_MAX];
+static pthread_mutex_t _records_lock = PTHREAD_MUTEX_INITIALIZER;
+
+}
+
+l4_uint64_t
+Timing_stats::now_us()
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+void
+Timing_stats::record(unsigned category, std::string const &name,
+                     l4_uint64_t time_us, l4_int64_t value)
+{
+  if (category >= L4VBUS_TIMING_MAX)
+    return;
+
+  l4vbus_timing_record_t r;
+  r.time_us = time_us;
+  r.value = value;
+
+  char const *n = name.c_str();
+  if (name.size() >= sizeof(r.name))
+    n += name.size() - (sizeof(r.name) - 1);
+
+  strncpy(r.name, n, sizeof(r.name) - 1);
+  r.name[sizeof(r.name) - 1] = 0;
+
+  Pthread_mutex_guard g(&_records_lock);
+  _records[category].push_back(r);
+}
+
+void
+Timing_stats::clear(unsigned category)
+{
+  if (category >= L4VBUS_TIMING_MAX)
+    return;
+
+  Pthread_mutex_guard g(&_records_lock);
+  _records[category].clear();
+}
+
+int
+Timing_stats::get(unsigned category, unsigned index,
+                  l4vbus_timing_record_t *rec)
+{
+  if (category >= L4VBUS_TIMING_MAX)
+    return -L4_EINVAL;
+
+  Pthread_mutex_guard g(&_records_lock);
+  if (index >= _records[category].size())
+    return -L4_ENOENT;
+
+  *rec = _records[category][index];
+  return 0;
+}
+
+unsigned
+Timing_stats::count(unsigned category)
+{
+  if (category >= L4VBUS_TIMING_MAX)
+    return 0;
+
+  Pthread_mutex_guard g(&_records_lock);
+  return _records[category].size();
+}
+
+void
+Timing_stats::print_sorted(unsigned category, unsigned max)
+{
+  if (category >= L4VBUS_TIMING_MAX)
+    return;
+
+  Record_list l;
+  {
+    Pthread_mutex_guard g(&_records_lock);
+    l = _records[category];
+  }
+
+  std::stable_sort(l.begin(), l.end(),
+                   [](l4vbus_timing_record_t const &a,
+                      l4vbus_timing_record_t const &b)
+                   { return a.time_us > b.time_us; });
+
+  if (l.size() > max)
+    l.resize(max);
+
+  for (auto const &r: l)
+    printf("  %10llu us  %s\n", (unsigned long long)r.time_us, r.name);
+}
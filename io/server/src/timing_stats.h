@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <l4/sys/types.h>
+#include <l4/vbus/vbus_platform_stats>
+
+#include <string>
+
+/**
+ * Timing records reported via the platform control interface.
+ *
+ * Records are collected per category (see L4vbus_timing_category) and can be
+ * queried by clients with L4vbus::Platform_stats::timing(). All functions are
+ * thread safe.
+ */
+class Timing_stats
+{
+public:
+  /// Current time in microseconds.
+  static l4_uint64_t now_us();
+
+  /**
+   * Add a record to a category.
+   *
+   * Names exceeding the record size are truncated at the front, as the end
+   * of a device path is the more distinctive part.
+   */
+  static void record(unsigned category, std::string const &name,
+                     l4_uint64_t time_us, l4_int64_t value = 0);
+
+  /// Drop all records of a category.
+  static void clear(unsigned category);
+
+  /**
+   * Get a record.
+   *
+   * \retval 0           Success.
+   * \retval -L4_EINVAL  Invalid category.
+   * \retval -L4_ENOENT  No record with the given index.
+   */
+  static int get(unsigned category, unsigned index,
+                 l4vbus_timing_record_t *rec);
+
+  /// Number of records in a category.
+  static unsigned count(unsigned category);
+
+  /**
+   * Print the records of a category, longest first.
+   *
+   * \param max  Maximum number of records to print.
+   */
+  static void print_sorted(unsigned category, unsigned max);
+
+  /**
+   * Record a start-up step (see L4vbus_startup_step) that took at least
+   * `Startup_min_us`.
+   *
+   * \param name  Function returning the name, only called if the step is
+   *              recorded.
+   */
+  template<typename NAME>
+  static void record_startup_step(unsigned kind, l4_uint64_t start_us,
+                                  NAME &&name)
+  {
+    l4_uint64_t t = now_us() - start_us;
+    if (t >= Startup_min_us)
+      record(L4VBUS_TIMING_STARTUP, name(), t, kind);
+  }
+
+  /// Shorter start-up steps are not recorded, phases are always recorded.
+  enum { Startup_min_us = 100 };
+};
@@ -6,6 +6,7 @@
  */
 
 
+#include "config_snapshot.h"
 #include "debug.h"
 #include "gpio"
 #include "hw_device.h"
@@ -162,6 +163,7 @@ public:
     if (tag != "pins")
       return -L4_ENODEV;
     _pins[val] = true;
+    Config_snapshot::get()->unsupported("sets GPIO pin filters");
     return 0;
   }
 
@@ -172,6 +174,7 @@ public:
       return -L4_ENODEV;
     if (!_pins.set_range(s, e, true))
       return -L4_ERANGE;
+    Config_snapshot::get()->unsupported("sets GPIO pin filters");
     return 0;
   }
 
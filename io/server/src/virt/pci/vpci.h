@@ -9,6 +9,7 @@
 
 #include <l4/vbus/vbus_interfaces.h>
 
+#include "pool_alloc.h"
 #include "virt/vdevice.h"
 #include <pci-if.h>
 
@@ -246,7 +247,7 @@ namespace Pci {
  * An abstract virtual PCI capability, provided
  * by a virtualized PCI device in the config space.
  */
-class Pci_capability
+class Pci_capability : public Pool_object
 {
   Pci_capability *_next = 0;
   l4_uint8_t _offset; ///< Offset in the PCI config space (in bytes)
@@ -138,6 +138,36 @@ Pci_bridge::find_bridge(unsigned bus)
 }
 
 
+/**
+ * Add the MSI sources of all functions on the secondary bus of this bridge
+ * and on the busses behind it to `map`.
+ */
+void
+Pci_bridge::collect_bus_msi_srcs(Msi_src_map *map)
+{
+  Msi_src_info si(0);
+  si.query() = Msi_src_info::Query_requester_id;
+  si.bus() = _secondary;
+
+  for (unsigned d = 0; d < Bus::Devs; ++d)
+    for (unsigned f = 0; f < Dev::Fns; ++f)
+      {
+        Pci_dev *p = _bus.dev(d)->fn(f);
+        if (!p)
+          continue;
+
+        si.dev() = d;
+        si.fn() = f;
+        if (Io_irq_pin::Msi_src *s = p->msi_src())
+          map->emplace(si.v & 0xffff, s);
+      }
+
+  for (unsigned d = 0; d < Bus::Devs; ++d)
+    for (unsigned f = 0; f < Dev::Fns; ++f)
+      if (Pci_bridge *b = dynamic_cast<Pci_bridge*>(_bus.dev(d)->fn(f)))
+        b->collect_bus_msi_srcs(map);
+}
+
 Pci_dev *
 Pci_bridge::child_dev(unsigned bus, unsigned char dev, unsigned char fn)
 {
@@ -88,6 +88,7 @@ public:
   void add_child_fixed(Device *d, Pci_dev *vp, unsigned dn, unsigned fn);
 
   Pci_bridge *find_bridge(unsigned bus);
+  void collect_bus_msi_srcs(Msi_src_map *map);
   void setup_bus();
   void finalize_setup() override;
 
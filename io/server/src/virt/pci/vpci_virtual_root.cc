@@ -43,6 +43,8 @@ public:
   { return 1 << L4VBUS_INTERFACE_PCI; }
 
   Io_irq_pin::Msi_src *find_msi_src(Msi_src_info si) override;
+  void collect_msi_srcs(Msi_src_map *map) override
+  { collect_bus_msi_srcs(map); }
 
 private:
   Device *_host;
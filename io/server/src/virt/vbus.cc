@@ -807,6 +807,12 @@ System_bus::find_msi_src(Msi_src_info si)
       if (Msi_src_feature *msi = dev->find_feature<Msi_src_feature>())
         return msi->msi_src();
     }
+  else if (si.query() == Msi_src_info::Query_requester_id)
+    {
+      auto i = _msi_srcs.find(si.v & 0xffff);
+      if (i != _msi_srcs.end())
+        return i->second;
+    }
   else if (si.query() != Msi_src_info::Query_none)
     return Device::find_msi_src(si);
 
@@ -888,6 +894,11 @@ System_bus::finalize()
         d->set_handle(_devices_by_id.size());
         _devices_by_id.push_back(*d);
       }
+
+  // requester-ID based MSI lookups are served from this map only, so
+  // rebuild it whenever devices are added to the bus
+  _msi_srcs.clear();
+  collect_msi_srcs(&_msi_srcs);
 }
 
 }
@@ -236,6 +236,7 @@ private:
   Int_property _num_msis;
   Dma_domain_group _dma_domain_group;
   std::vector<Device *> _devices_by_id;
+  Msi_src_map _msi_srcs;
 };
 
 }
@@ -21,7 +21,9 @@ Dev_factory::create(std::string const &_class)
       return 0;
     }
 
-  return i->second->vcreate();
+  Device *d = i->second->vcreate();
+  Config_snapshot::get()->created(d, _class.c_str());
+  return d;
 }
 
 }
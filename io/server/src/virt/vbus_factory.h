@@ -15,6 +15,8 @@
 #include <string>
 #include <typeinfo>
 
+#include "__acpi.h"
+#include "config_snapshot.h"
 #include "hw_device.h"
 #include "type_matcher.h"
 #include "vdevice.h"
@@ -62,7 +64,18 @@ protected:
 public:
   static Device *create(std::string const &_class);
   static Device *create(Hw::Device *f)
-  { return match(f); }
+  {
+    // a device referenced by a virtual bus must be fully initialized
+    Hw::Async_init::complete(f);
+    acpi_complete_probe(f);
+    Device *d = match(f);
+    Config_snapshot::get()->created(d, f);
+    return d;
+  }
+
+  /// Check whether a virtual device class can be created by name.
+  static bool has_class(std::string const &_class)
+  { return name_map().find(_class) != name_map().end(); }
 
 private:
   Dev_factory(Dev_factory const &);
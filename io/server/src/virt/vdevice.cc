@@ -84,4 +84,11 @@ Device::find_msi_src(Msi_src_info si)
       return s;
   return nullptr;
 }
+
+void
+Device::collect_msi_srcs(Msi_src_map *map)
+{
+  for (Device *d = children(); d; d = d->next())
+    d->collect_msi_srcs(map);
+}
 }
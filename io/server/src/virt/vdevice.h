@@ -10,6 +10,7 @@
 #include <l4/cxx/avl_set>
 #include <string>
 #include <vector>
+#include <map>
 #include <l4/cxx/ipc_stream>
 #include <l4/vbus/vbus_types.h>
 
@@ -128,6 +129,18 @@ public:
 
   virtual Io_irq_pin::Msi_src *find_msi_src(Msi_src_info si);
 
+  /// Map from PCI requester ID (see Msi_src_info) to MSI source.
+  typedef std::map<l4_uint16_t, Io_irq_pin::Msi_src *> Msi_src_map;
+
+  /**
+   * Add all MSI sources below this device that can be found via
+   * find_msi_src() with a requester ID query to `map`.
+   *
+   * Sources already in the map take precedence, in the same way as the first
+   * match wins in find_msi_src().
+   */
+  virtual void collect_msi_srcs(Msi_src_map *map);
+
   Device() : _name("(noname)") {}
 
   void dump(int indent) const override;
@@ -19,6 +19,7 @@
 #include <l4/re/util/cap_alloc>
 
 #include "irqs.h"
+#include "pool_alloc.h"
 #include "vdevice.h"
 
 namespace Vi {
@@ -95,7 +96,7 @@ private:
   int unmask_irq(unsigned irqn);
   int set_mode(unsigned irqn, l4_umword_t mode);
 
-  class Sw_irq_pin : public cxx::Avl_tree_node
+  class Sw_irq_pin : public cxx::Avl_tree_node, public Pool_object
   {
   private:
     enum
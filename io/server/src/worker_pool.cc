@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+
+#include "worker_pool.h"
+#include "debug.h"
+
+#include <algorithm>
+#include <pthread.h>
+
+namespace {
+
+// protects the queue, the job states and the number of threads
+pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t _done = PTHREAD_COND_INITIALIZER;
+
+}
+
+unsigned Worker_pool::_max_threads;
+unsigned Worker_pool::_threads;
+
+std::deque<Worker_pool::Job *> &
+Worker_pool::queue()
+{
+  static std::deque<Job *> _queue;
+  return _queue;
+}
+
+void
+Worker_pool::reserve(unsigned threads)
+{
+  pthread_mutex_lock(&_lock);
+  if (threads > _max_threads)
+    _max_threads = threads;
+  pthread_mutex_unlock(&_lock);
+}
+
+void *
+Worker_pool::worker(void *)
+{
+  pthread_mutex_lock(&_lock);
+  while (!queue().empty())
+    {
+      Job *job = queue().front();
+      queue().pop_front();
+      job->_state = Job::Running;
+      pthread_mutex_unlock(&_lock);
+
+      job->run();
+
+      pthread_mutex_lock(&_lock);
+      job->_state = Job::Done;
+      pthread_cond_broadcast(&_done);
+    }
+
+  // idle workers exit, submit() creates new ones when needed
+  --_threads;
+  pthread_mutex_unlock(&_lock);
+  return 0;
+}
+
+void
+Worker_pool::submit(Job *job)
+{
+  pthread_mutex_lock(&_lock);
+  job->_state = Job::Queued;
+  queue().push_back(job);
+  bool spawn = _threads < _max_threads;
+  if (spawn)
+    ++_threads;
+  pthread_mutex_unlock(&_lock);
+
+  if (!spawn)
+    return;
+
+  pthread_t t;
+  if (pthread_create(&t, 0, worker, 0) != 0)
+    {
+      // the job stays queued and runs in wait()
+      d_printf(DBG_WARN, "warning: cannot create worker thread\n");
+      pthread_mutex_lock(&_lock);
+      --_threads;
+      pthread_mutex_unlock(&_lock);
+      return;
+    }
+
+  pthread_detach(t);
+}
+
+void
+Worker_pool::wait(Job *job)
+{
+  pthread_mutex_lock(&_lock);
+  if (job->_state == Job::Queued || job->_state == Job::Idle)
+    {
+      // no worker picked it up yet, do not wait for one
+      if (job->_state == Job::Queued)
+        {
+          auto &q = queue();
+          q.erase(std::find(q.begin(), q.end(), job));
+        }
+
+      job->_state = Job::Running;
+      pthread_mutex_unlock(&_lock);
+
+      job->run();
+
+      pthread_mutex_lock(&_lock);
+      job->_state = Job::Done;
+    }
+  else
+    while (job->_state != Job::Done)
+      pthread_cond_wait(&_done, &_lock);
+
+  pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2025 Kernkonzept GmbH.
+ *
+ * License: see LICENSE.spdx (in this directory or the directories above)
+ */
+#pragma once
+
+#include <deque>
+
+/**
+ * Pool of worker threads shared by the concurrent parts of io, i.e., the
+ * asynchronous device initialization (Hw::Async_init) and the suspend and
+ * resume of devices (Pm).
+ *
+ * Worker threads are created on demand, up to the largest number requested
+ * with reserve(), and exit as soon as no job is queued. A job still queued
+ * when it is waited for runs in the waiting thread.
+ */
+class Worker_pool
+{
+public:
+  class Job
+  {
+    friend class Worker_pool;
+
+  public:
+    /// The work to do, runs on a worker thread or in wait().
+    virtual void run() = 0;
+
+  protected:
+    ~Job() = default;
+
+  private:
+    enum State { Idle, Queued, Running, Done };
+    State _state = Idle;
+  };
+
+  /// Allow at least `threads` worker threads.
+  static void reserve(unsigned threads);
+
+  /// Queue `job` for a worker thread.
+  static void submit(Job *job);
+
+  /**
+   * Wait until `job` is done.
+   *
+   * Runs the job in the calling thread if no worker picked it up yet.
+   */
+  static void wait(Job *job);
+
+private:
+  static std::deque<Job *> &queue();
+  static void *worker(void *);
+
+  static unsigned _max_threads;
+  static unsigned _threads;
+};
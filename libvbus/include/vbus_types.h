@@ -69,6 +69,17 @@ enum l4vbus_resource_flags_t {
   L4VBUS_RESOURCE_F_MEM_MMIO_READ = 0x2000,
   /** Writing needs to be performed using the MMIO space protocol. */
   L4VBUS_RESOURCE_F_MEM_MMIO_WRITE = 0x4000,
+  /**
+   * Interrupt resource is a message-signaled interrupt (MSI) of a PCI
+   * device, programmed by the vbus provider.
+   * The trigger mode is given by the L4_IRQ_F_* bits as usual.
+   */
+  L4VBUS_RESOURCE_F_IRQ_MSI = 0x400,
+  /**
+   * Interrupt resource is an MSI-X interrupt of a PCI device, programmed by
+   * the vbus provider using the first entry of the MSI-X table.
+   */
+  L4VBUS_RESOURCE_F_IRQ_MSIX = 0x800,
 };
 
 enum l4vbus_consts_t {